@@ -1,24 +1,29 @@
+// gcc -o cl command_line.c wavegen.c -lm
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include "wavegen.h"
 
 #define MAX_INPUT 20
-#define INTEGER 0
-#define FLOAT 1
-#define FREQUENCY_MIN 0.0
-#define FREQUENCY_MAX 100.0
-#define MEAN_MIN 1.0
-#define MEAN_MAX 10.0
-#define AMPLITUDE_MIN 0
-#define AMPLITUDE_MAX 4095
+#define INTEGER WG_INTEGER
+#define FLOAT WG_FLOAT
+
+// Ranges come from the engine library so every front end agrees on them
+#define FREQUENCY_MIN WG_FREQUENCY_MIN
+#define FREQUENCY_MAX WG_FREQUENCY_MAX
+#define MEAN_MIN WG_MEAN_MIN
+#define MEAN_MAX WG_MEAN_MAX
+#define AMPLITUDE_MIN WG_AMPLITUDE_MIN
+#define AMPLITUDE_MAX WG_AMPLITUDE_MAX
 
 float frequency;
 float mean;
 unsigned int amplitude;
-char* waveform_options[] = {"sine", "square", "triangular", "sawtooth"};
+char* waveform_options[] = {"sine", "square", "sawtooth", "triangular"};      // Same order as the engine library
 int current_waveform = -1;
 const unsigned int len_waveform = sizeof(waveform_options)/sizeof(waveform_options[0]);
 
@@ -34,7 +39,7 @@ void usage(char* progname) {
 	printf("[-f frequency]: (float) Frequency of wave (Hz). Range: %f - %f\n", FREQUENCY_MIN, FREQUENCY_MAX);
 	printf("[-m mean]: (float) Prescaled mean of wave. Range: %f - %f\n", MEAN_MIN, MEAN_MAX);
 	printf("[-a amplitude]: (unsigned int) Amplitude of wave. Range: %d - %d\n", AMPLITUDE_MIN, AMPLITUDE_MAX);
-    printf("[-w waveform]: (string) Type of waveform. Options: sine, square, triangular, sawtooth\n");
+    printf("[-w waveform]: (string) Type of waveform. Options: sine, square, sawtooth, triangular\n");
     exit(EXIT_FAILURE);
 }
 
@@ -172,49 +177,24 @@ bool convertNum(char* input, void* var_pointer, int format, float min, float max
     Returns:
         true when input is in correct format, else false
     */
-    char format_type[20] = "";
-    char c;
-    
-    if (format == INTEGER) {
-        int temp;
-        int* var_pointer_2 = (int*)var_pointer;
-        sprintf(format_type, "integer");
-        if (sscanf(input, "%d %c", &temp, &c) == 1) {
-            if (temp < (int) min) {
-                printf("%s is less than minimum number %d\n\n", input, (int) min);
-                return false;
-            }
-            else if (temp > (int) max) {
-                printf("%s is greater than maximum number %d\n\n", input, (int) max);
-                return false;
-            }
-            *var_pointer_2 = temp;
-            return true;
-        }
-    }
-    else if (format == FLOAT) {
-        float temp;
-        float* var_pointer_2 = (float*)var_pointer;
-        sprintf(format_type, "float");
-        if (sscanf(input, "%f %c", &temp, &c) == 1) {
-            if (temp < min) {
-                printf("%s is less than minimum number %f\n\n", input, min);
-                return false;
-            }
-            else if (temp > max) {
-                printf("%s is greater than maximum number %f\n\n", input, max);
-                return false;
-            }
-            *var_pointer_2 = temp;
-            return true;
-        }
-    }
-    else {
+    if (format != INTEGER && format != FLOAT) {
         printf("Unsupported format\n\n");
         return false;
     }
 
-    printf("Invalid format. %s is not %s\n\n", input, format_type);
+    switch (wg_parse_number(input, var_pointer, format, min, max)) {
+        case WG_OK:
+            return true;
+        case WG_ERR_BELOW:
+            if (format == INTEGER) printf("%s is less than minimum number %d\n\n", input, (int) min);
+            else printf("%s is less than minimum number %f\n\n", input, min);
+            return false;
+        case WG_ERR_ABOVE:
+            if (format == INTEGER) printf("%s is greater than maximum number %d\n\n", input, (int) max);
+            else printf("%s is greater than maximum number %f\n\n", input, max);
+            return false;
+    }
+    printf("Invalid format. %s is not %s\n\n", input, format == INTEGER ? "integer" : "float");
     return false;
 }
 
@@ -1,4 +1,5 @@
-// cc -o draft draft.c -lncurses -lpthread -lm
+// cc -o draft draft3.c wavegen.c -lncurses -lpthread -lm
+// Simulated backend, no QNX or board required: cc -DSIMULATION -o draft draft3.c wavegen.c -lncurses -lpthread -lm
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,11 +8,51 @@
 #include <ctype.h>
 #include <pthread.h>
 #include <ncurses.h>
+#include <stdint.h>
+#ifdef SIMULATION
+// Stand-ins for hw/pci.h, hw/inout.h and sys/neutrino.h, implemented at the end of this file
+#define PCI_SHARE 0
+#define PCI_INIT_ALL 0
+#define PCI_IO_ADDR(x) (x)
+#define _NTO_TCTL_IO 0
+struct pci_dev_info {
+    uint16_t VendorId;
+    uint16_t DeviceId;
+    uint64_t CpuBaseAddress[6];
+};
+int pci_attach(unsigned flags);
+void* pci_attach_device(void* hdl, unsigned flags, unsigned idx, struct pci_dev_info* info);
+int pci_detach_device(void* hdl);
+uintptr_t mmap_device_io(size_t len, uint64_t io);
+int ThreadCtl(int cmd, void* data);
+unsigned delay(unsigned msec);
+void out8(uintptr_t port, uint8_t val);
+void out16(uintptr_t port, uint16_t val);
+uint8_t in8(uintptr_t port);
+#else
 #include <hw/pci.h>
 #include <hw/inout.h>
 #include <sys/neutrino.h>
+#endif
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <time.h>
 #include <math.h>
+#include <signal.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "trace.h"
+#include "shm_tap.h"
+#include "wavegen.h"
 
 // PCI Registers
 #define	INTERRUPT		iobase[1] + 0				// Badr1 + 0 : also ADC register
@@ -41,39 +82,560 @@
 
 
 #define MAX_INPUT 20
-#define INTEGER 0
-#define FLOAT 1
+#define INTEGER WG_INTEGER
+#define FLOAT WG_FLOAT
 
-#define FREQUENCY_MIN 0.0
-#define FREQUENCY_MAX 10.0
+// Ranges come from the engine library so every front end agrees on them
+#define FREQUENCY_MIN WG_FREQUENCY_MIN
+#define FREQUENCY_MAX WG_FREQUENCY_MAX
 #define FREQUENCY_STEPS 100
 #define FREQUENCY_STEP_SIZE (FREQUENCY_MAX-FREQUENCY_MIN)/FREQUENCY_STEPS 
-#define MEAN_MIN 1.0
-#define MEAN_MAX 10.0
+#define MEAN_MIN WG_MEAN_MIN
+#define MEAN_MAX WG_MEAN_MAX
 #define MEAN_STEPS 100
 #define MEAN_STEP_SIZE (MEAN_MAX-MEAN_MIN)/MEAN_STEPS 
-#define AMPLITUDE_MIN 0
-#define AMPLITUDE_MAX 65535
+#define AMPLITUDE_MIN WG_AMPLITUDE_MIN
+#define AMPLITUDE_MAX WG_AMPLITUDE_MAX
 #define AMPLITUDE_STEPS 100
 #define AMPLITUDE_STEP_SIZE (AMPLITUDE_MAX-AMPLITUDE_MIN)/AMPLITUDE_STEPS 
 
-# define STEPS 100
-# define STEP_SIZE 2 * M_PI / STEPS
-uintptr_t iobase[6];
+// Keyboard Input
+#define KEY_BATCH_MAX 64                            // Keys folded into one parameter update at most
+#define KEY_REPEAT_GAP_NS 150000000                 // Same key again within this is treated as held
+#define KEY_ACCEL_INTERVAL_NS 500000000             // Step size doubles every interval a key is held
+#define KEY_ACCEL_MAX_SHIFT 3                       // Up to 8 steps per key
+
+// Output Timing
+#define SAMPLE_RATE 1000                            // DAC updates per second
+#define SAMPLE_PERIOD_NS (1000000000/SAMPLE_RATE)
+#define BLOCK_SIZE 32                               // Samples rendered per lock of global_mutex
+
+// Wavetable Store, tables and file format come from the engine library
+#define WAVETABLE_FILE "wavetable.bin"
+#define WAVETABLE_SIZE WG_TABLE_SIZE                // Samples per table (one period)
+#define WT_SQUARE_BL WG_TABLE_SQUARE_BL             // First band-limited square table
+#define WT_SAWTOOTH_BL WG_TABLE_SAWTOOTH_BL
+#define WT_NUM_TABLES WG_NUM_TABLES
+
+// Arbitrary Waveform Playback
+#define SAMPLE_FORMAT_INT16 0                       // Signed 16-bit raw samples
+#define SAMPLE_FORMAT_FLOAT 1                       // 32-bit float raw samples, files ending in .f32
+#define PLAYBACK_WINDOW (1 << 20)                   // Bytes advised ahead of and dropped behind playback
+
+// Additive Synthesis
+#define MAX_PARTIALS 512
+#define PARTIAL_LANES 8                             // Oscillators stepped together per sample, one SIMD register wide
+#define PARTIAL_REBUILD_INTERVAL 16                 // Reloads between full rebuilds of the additive table
+
+// Modulation Targets
+#define MOD_NONE 0
+#define MOD_AM 1                                    // LFO scales the shape by (1 + depth * lfo)
+#define MOD_FM 2                                    // LFO scales frequency by (1 + depth * lfo)
+#define MOD_PM 3                                    // LFO offsets phase by depth * lfo cycles
+#define LFO_FREQUENCY_MAX (SAMPLE_RATE / (2.0 * BLOCK_SIZE * CONTROL_DIVIDER))
+
+// Sweep Laws
+#define SWEEP_LINEAR 0                              // Frequency changes by a fixed step per sample
+#define SWEEP_LOG 1                                 // Frequency changes by a fixed ratio per sample
+#define SYNC_MARKER 0x01                            // DIO_PORTA bit pulsed at the start of each sweep
+
+// Noise Generators
+#define NOISE_LANES 8                               // Independent xoshiro128+ streams stepped together
+#define PINK_ROWS 16                                // Voss-McCartney rows, octaves of pink spectrum
+#define NOISE_BAND_Q 2.0                            // Q of band-pass filter centred on frequency
+
+// Envelope Stages
+#define MAX_ENVELOPE_POINTS 16
+#define ENV_IDLE -1                                 // Gate off and release finished, gain held
+#define ENV_RELEASE -2                              // Falling to zero after gate off
+                                                    // 0..num_points-1: approaching that point, num_points: sustaining
+
+// Trigger Modes
+#define TRIGGER_NONE 0
+#define TRIGGER_START 1                             // Rising edge starts output
+#define TRIGGER_STOP 2                              // Rising edge stops output, the next rising edge restarts it
+#define TRIGGER_GATE 3                              // Output while the line is high
+#define TRIGGER_LINE 0x01                           // DIO_PORTB bit watched for edges
+
+// Multiple Boards
+#define MAX_BOARDS 8
+#define SKEW_HISTORY 4096                           // Recent samples per board kept for the skew report
+
+// Simulated Backend
+#define SIM_BOARD_PORTS 0x1000                      // Ports per simulated board, 0x100 per base address
+#define SIM_IO_PORTS (SIM_BOARD_PORTS * MAX_BOARDS)
+#define SIM_TRIGGER_PERIOD_MS 250                   // Mean time between simulated trigger line edges
+
+// Stress Run (simulation builds)
+#define STRESS_MAX_UPDATERS 8
+#define STRESS_MAX_RATE 1000000                     // Updates per second per updater
+#define STRESS_SLOTS 65536                          // Published changes kept for latency lookups, power of two
+#define STRESS_MAX_LATENCIES (1 << 20)              // Rendered changes whose latency is kept
+#define STRESS_WAVEFORMS 4                          // sine, square, sawtooth, triangular, in waveform_options order
+#define STRESS_SLOPE_MARGIN 1.05                    // Slack on the steepest legitimate step between samples
+#define STRESS_CODE_MARGIN 2                        // Truncation of both samples to whole codes
+#define STRESS_RANDOM 0
+#define STRESS_ADVERSARIAL 1
+
+// Render Kernels
+#define FORMAT_CODE 0                               // unsigned int DAC codes, clamped at zero
+#define FORMAT_FLOAT 1                              // float (shape + mean) * amplitude, unclamped
+#define NUM_FORMATS 2
+#define MAX_CHANNELS 2                              // Interleaved channels carrying the same signal
+
+// Oscilloscope and Spectrum View
+#define SCOPE_SIZE 256                              // Snapshot samples, power of two for the FFT
+#define SCOPE_DECIMATION 2                          // Output samples per snapshot sample
+#define SCOPE_ROWS 10
+#define SCOPE_COLS 64
+#define SPECTRUM_BARS 32
+#define SPECTRUM_ROWS 8
+#define SPECTRUM_RANGE_DB 60.0                      // Bars span this far below the strongest bin
+#define UI_REFRESH_US 100000
+
+// Control Loop
+#define CONTROL_MAX_EVENTS 16                       // epoll events handled per wakeup
+#define COMMAND_MAX_CLIENTS 8                       // Concurrent connections to the command socket
+#define COMMAND_LINE_SIZE 128
+#define CONTROL_PATH_SIZE 1024                      // Longest directory of the partial file
+
+// Signal Quality Analysis
+#define ANALYSIS_MIN_POINTS 1024                    // Smallest FFT worth reporting on
+#define ANALYSIS_LOBE 4                             // Half-width in bins of a Blackman-Harris tone
+#define ANALYSIS_HARMONICS 10                       // Harmonics counted towards THD
+
+// Control Record and Replay
+#define CONTROL_MAGIC 0x4C525443                    // "CTRL" little-endian
+#define CONTROL_VERSION 2
+#define CONTROL_HOLD 0x1                            // DC hold: one sample rendered and held until the next record
+#define CONTROL_ARMED 0x2                           // Trigger armed: idle level held until the next record
+#define CONTROL_START 0x4                           // Trigger started output, phase restarts at 0
+#define CONTROL_PARTIALS 0x8                        // Reloaded partial list follows, applied before the next record
+#define REPLAY_TAIL SAMPLE_RATE                     // Samples rendered after the last recorded change
+
+// Channel Bank
+#define BANK_MAX_CHANNELS 1024
+#define BANK_WAVEFORMS 4                            // sine, square, sawtooth, triangular, in waveform_options order
+#define BANK_BENCH_SECONDS 1.0                      // Wall time spent rendering per benchmark run
+
+// Host Mode
+#define HOST_MAX_INSTANCES 1024
+#define HOST_MAX_WORKERS 64
+#define HOST_DEQUE_SIZE 1024                        // Power of two, at least HOST_MAX_INSTANCES
+#define HOST_SECONDS 5.0                            // Length of a host run
+#define HOST_IDLE_NS 200000                         // Longest an idle worker sleeps before looking for work to steal
+
+// Quality Watchdog
+#define QUALITY_FULL 0                              // Interpolated table reads, full tables, LFO every block
+#define QUALITY_NEAREST 1                           // Nearest table entry, specialised kernels allowed
+#define QUALITY_SMALL_TABLES 2                      // Tables decimated by SMALL_TABLE_DECIMATION
+#define QUALITY_LOW_CONTROL 3                       // LFO evaluated every CONTROL_DIVIDER blocks
+#define NUM_QUALITY 4
+#define SMALL_TABLE_DECIMATION 8
+#define SMALL_TABLE_SIZE (WAVETABLE_SIZE / SMALL_TABLE_DECIMATION)
+#define SMALL_TABLE_MAX_LEVEL 7                     // Richest band-limited level below the Nyquist of a small table
+#define CONTROL_DIVIDER 4
+#define WATCHDOG_WINDOW 16                          // Blocks per headroom window
+#define WATCHDOG_LOW 0.25                           // Step down when a window's worst headroom falls below this
+#define WATCHDOG_HIGH 0.6                           // Step up after WATCHDOG_RECOVER windows in a row stay above this
+#define WATCHDOG_RECOVER 8
+#define WATCHDOG_LOG_SIZE 64                        // Transitions kept for the exit report
+#define WATCHDOG_LOG_LINE 96
+
+// Event Tracing
+#define TRACE_THREADS 4
+#define TRACE_SIZE 65536                            // Events per thread ring, power of two
+
+// Thread Profiling
+#define PROFILE_THREADS 16
+#define LOCK_GLOBAL 0                               // Indices into profile_thread.locks
+#define LOCK_BOARD 1
+#define LOCK_SHUTDOWN 2
+#define NUM_LOCKS 3
+#if defined(__linux__) && !defined(RUSAGE_THREAD)
+#define RUSAGE_THREAD 1                             // Linux value, glibc only names it under _GNU_SOURCE
+#endif
+
+struct trace_ring {
+    char name[TRACE_NAME_SIZE];
+    uint64_t head;                                  // Events ever recorded, written only by the owning thread
+    struct trace_event events[TRACE_SIZE];
+};
+
+struct lock_stats {
+    uint64_t acquired;
+    uint64_t contended;                             // Acquisitions that found the mutex held
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+};
+
+// Written only by the owning thread, read unlocked by the report
+struct profile_thread {
+    char name[TRACE_NAME_SIZE];
+    clockid_t cpu_clock;                            // Readable from any thread while the thread is alive
+    bool cpu_available;                             // FALSE when the thread's CPU clock could not be obtained
+    uint64_t cpu_ns;                                // cpu_clock at the last profile_snapshot()
+    long voluntary;                                 // Context switches as of the thread's last profile_sample()
+    long involuntary;
+    struct lock_stats locks[NUM_LOCKS];
+};
+
+struct sample_file {
+    const void* map;                                // Read-only mapping of the whole file
+    size_t map_size;
+    size_t num_samples;
+    int format;
+    double rate;                                    // Sample rate of the file (Hz)
+    double position;                                // Playback position in file samples
+    bool loop;
+    size_t advised_window;                          // Window index of the last read-ahead hint
+};
+
+struct modulation {
+    int target;
+    int waveform;                                   // Index into waveformArray used as the LFO
+    float frequency;                                // LFO frequency (Hz)
+    float depth;
+    double phase;                                   // LFO phase at the last evaluation, in cycles
+    double value;                                   // LFO output at the last evaluation
+    double ramp;                                    // Ramped LFO value at the end of the last block
+    double step;                                    // Ramp increment per sample towards value
+    int countdown;                                  // Blocks until the LFO is evaluated again
+};
+
+struct sweep {
+    float start;                                    // Start frequency (Hz)
+    float end;                                      // End frequency (Hz)
+    float duration;                                 // Sweep length (s)
+    int law;
+    bool sync;                                      // Pulse SYNC_MARKER on DIO_PORTA at sweep start
+    double phase;                                   // In cycles [0, 1)
+    double inc;                                     // Phase increment per sample
+    double inc_step;                                // Added to (linear) or multiplied into (log) inc per sample
+    long remaining;                                 // Samples left in the current sweep
+    int sync_sample;                                // Index of the sweep start within the last block, -1 if none
+};
+
+struct noise_state {
+    uint32_t s[4][NOISE_LANES];                     // xoshiro128+ state, one column per lane
+    double pink_rows[PINK_ROWS];
+    double pink_sum;                                // Running sum of pink_rows
+    uint32_t pink_counter;
+    float band_frequency;                           // Frequency the band-pass coefficients were computed for
+    double b0, a1, a2;                              // Band-pass biquad, b1 = 0 and b2 = -b0
+    double x1, x2, y1, y2;
+};
+
+struct envelope {
+    bool enabled;
+    bool gate;                                      // Gate requested by the control path
+    bool gated;                                     // Gate the envelope last responded to
+    int num_points;
+    int duration[MAX_ENVELOPE_POINTS];              // Samples taken to reach each point
+    float level[MAX_ENVELOPE_POINTS];
+    int release;                                    // Samples taken to fall to zero after gate off
+    int stage;
+    int remaining;                                  // Samples left in the current segment
+    double gain;
+    double step;                                    // Added to gain per sample
+};
+
+struct trigger {
+    int mode;
+    bool running;                                   // Output currently enabled
+    uint8_t level;                                  // Last level read from TRIGGER_LINE
+    struct timespec edge_time;                      // When the edge that started output happened
+    long count;                                     // Edges that started output
+    long last_ns;                                   // Trigger-to-first-sample latency of the last start
+    long max_ns;
+    double total_ns;
+};
+
+struct render_plan;
+typedef double (*render_kernel)(void* out, int n, double phase, const struct render_plan* plan);
+
+struct render_plan {
+    render_kernel kernel;                           // NULL when the general render_block() path is needed
+    const void* table;                              // Period table the kernel reads
+    double phase_inc;
+    int table_size;                                 // Entries in table
+    double offset;                                  // mean
+    double gain;                                    // amplitude
+    unsigned long version;                          // param_version the plan was selected for
+};
+
+struct board {
+    uintptr_t iobase[6];                            // Mapped base addresses, the register macros index this
+    void* hdl;
+    pthread_t thread;                               // Output thread, board 0 is driven by the generator itself
+    long late_total;                                // Time sample writes fell behind the shared clock (ns)
+    long late_max;
+    long late_count;
+    unsigned long missed;                           // Blocks superseded before this board finished them
+    uint64_t due_at[SKEW_HISTORY];                  // Recent deadlines (ns), slot chosen by deadline
+    long late_at[SKEW_HISTORY];                     // How late each of those writes was (ns)
+};
+
+// Latest rendered block, handed from the generator to the other boards' output threads
+struct board_block {
+    unsigned int samples[BLOCK_SIZE];
+    int n;
+    struct timespec start;                          // Shared clock deadline of samples[0]
+    unsigned long seq;
+};
+
+// Headroom is the share of a sample period left between finishing a block and its first deadline
+struct watchdog {
+    bool enabled;                                   // FALSE when -Q pins the quality
+    int blocks;                                     // Blocks in the current window
+    double window_min;                              // Worst headroom in the current window
+    double window_total;
+    int good_windows;                               // Consecutive windows above WATCHDOG_HIGH
+    double last_min;                                // Figures of the last complete window
+    double last_mean;
+    long transitions;
+    uint64_t start;                                 // trace_clock() when the generator started
+    char log[WATCHDOG_LOG_SIZE][WATCHDOG_LOG_LINE];
+    FILE* log_fp;                                   // Live log with -W
+};
+
+// One waveform's channels, each field contiguous so a sweep over channels vectorizes
+struct channel_group {
+    int count;
+    float phase[BANK_MAX_CHANNELS] __attribute__((aligned(64)));   // Cycles [0, 1)
+    float phase_inc[BANK_MAX_CHANNELS] __attribute__((aligned(64)));
+    float gain[BANK_MAX_CHANNELS] __attribute__((aligned(64)));    // amplitude
+    float offset[BANK_MAX_CHANNELS] __attribute__((aligned(64)));  // mean * amplitude
+};
+
+struct channel_bank {
+    struct channel_group group[BANK_WAVEFORMS];
+    int count;
+};
+
+// One independent generator in host mode, rendered by whichever worker runs its job
+struct host_instance {
+    struct wg_engine* engine;                       // Set up before the workers start, rendering never allocates
+    int rate;                                       // Output rate (Hz)
+    long period_ns;                                 // One block at rate
+    uint64_t deadline;                              // When the pending block must be ready (ns)
+    int owner;                                      // Worker that releases this instance's jobs
+    int queued;                                     // A job is in some deque, so no second one is released
+    unsigned int block[BLOCK_SIZE];
+    long blocks;
+    long stolen;                                    // Blocks rendered by a worker other than the owner
+    long missed;                                    // Blocks finished after their deadline
+    double render_total;                            // ns
+    double render_max;
+};
+
+// Chase-Lev deque: the owner pushes and pops at bottom, other workers steal from top
+struct work_deque {
+    long top;
+    long bottom;
+    int jobs[HOST_DEQUE_SIZE];                      // Instance indices
+};
+
+struct host_worker {
+    struct work_deque deque;
+    pthread_t thread;
+    int index;
+    long jobs;
+    long steals;
+};
+
+#ifdef SIMULATION
+// A published parameter change, version is stored last so the DAC side can trust the rest
+struct stress_slot {
+    unsigned long version;
+    uint64_t published_ns;
+    float frequency;
+    float mean;
+    unsigned int amplitude;
+    int waveform;
+};
+
+struct stress_updater {
+    pthread_t thread;
+    int index;
+    unsigned int seed;
+    long updates;
+};
+
+// -X settings, and the analysis of every code written to the first board's channel 0
+struct stress {
+    float seconds;                                  // 0 when no stress run was requested
+    int updaters;
+    int rate;                                       // Updates per second per updater, 0 for back to back
+    int mode;
+    float p99_limit_us;                             // 0 for no limit
+    volatile bool running;
+    struct stress_slot slots[STRESS_SLOTS];
+    unsigned long version;                          // Version of the codes being checked
+    double bound;                                   // Largest legitimate step for them, negative when not checked
+    unsigned int last_code;
+    uint64_t samples;
+    uint64_t versions_seen;
+    uint64_t unmatched;                             // Versions written before their slot was filled or after it was reused
+    uint64_t checked;                               // Code pairs compared against a bound
+    uint64_t glitches;
+    double worst_excess;                            // Largest step over the bound, in codes
+    uint64_t transitions;                           // Code pairs across a parameter change
+    unsigned int max_transition;
+    uint64_t latency_count;
+    uint64_t* latency_ns;
+};
+#endif
+
+// Control file is one control_header followed by control_records in sample order
+struct control_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed;                                  // Noise seed of the recorded run
+    uint32_t sample_rate;
+};
+
+struct control_record {
+    uint64_t sample;                                // Output sample the parameters took effect at
+    float frequency;
+    float mean;
+    int32_t amplitude;
+    int16_t waveform;
+    uint8_t gate;
+    uint8_t quality;                                // Render quality the following blocks used
+    uint32_t flags;                                 // CONTROL_* state entered at sample
+    uint32_t count;                                 // Partials following a CONTROL_PARTIALS record
+};
+
+// One DAC write of the first board in a simulated run, see SIM_DAC_LOG
+struct capture_entry {
+    uint64_t sample;                                // sample_clock when the code was written
+    uint32_t code;
+    uint32_t reserved;
+};
+
+struct snapshot {
+    float samples[SCOPE_SIZE];                      // Ring of decimated DAC codes
+    unsigned long sequence;                         // Odd while the generator is writing samples
+    unsigned long written;                          // Samples ever written
+    int skip;                                       // Output samples until the next one is kept
+};
+
+// One connection to the command socket, commands are newline-terminated
+struct command_client {
+    int fd;                                         // -1 when the slot is free
+    int used;                                       // Bytes of an unfinished command in line
+    char line[COMMAND_LINE_SIZE];
+};
+
+// Descriptors multiplexed by control_loop(), -1 when a source is not in use
+struct control {
+    int epoll_fd;
+    int signal_fd;                                  // SIGINT, SIGTERM and, when tracing, SIGUSR2
+    int timer_fd;                                   // Display refresh
+    int inotify_fd;                                 // Directory of the partial file
+    int listen_fd;                                  // Command socket
+    char* partial_path;
+    char* partial_name;                             // File name part of partial_path, matched against inotify events
+    char* command_path;
+    struct command_client clients[COMMAND_MAX_CLIENTS];
+};
+
+// Net change of one batch of keys, in steps
+struct key_batch {
+    int amplitude;
+    int frequency;
+    int mean;
+    int waveform;
+    bool gate;                                      // Toggle the envelope gate
+    bool exit;
+};
+
+struct partial {
+    int harmonic;
+    double amplitude;
+    double phase;                                   // Radians
+};
+
+struct board boards[MAX_BOARDS];
+int num_boards = 1;
+struct board_block board_block;
+char* quality_names[] = {"full", "nearest", "small tables", "low control rate"};
+int quality = QUALITY_FULL;
+struct watchdog watchdog = {.enabled = TRUE, .window_min = 1.0, .last_min = 1.0, .last_mean = 1.0};
+struct host_instance* host_instances = NULL;
+struct host_worker* host_workers = NULL;
+char* host_engines = NULL;                          // wg_engine_size() bytes per instance
+int host_num_instances = 0;
+int host_num_workers = 0;
+volatile int host_stop = 0;
+struct tap_header* tap = NULL;                      // Shared-memory output tap, mapped with -o
+char* tap_name = NULL;
 unsigned int i;
 float frequency;
 float mean;
 unsigned int amplitude;
 unsigned int output;
-char* waveform_options[] = {"sine", "square", "sawtooth", "triangular"};
+char* waveform_options[] = {"sine", "square", "sawtooth", "triangular", "arbitrary", "additive", "chirp", "white", "pink", "bandnoise"};
 int current_waveform = -1;
 const unsigned int len_waveform = sizeof(waveform_options)/sizeof(waveform_options[0]);
 useconds_t freq_delay;
+char* wavetable_file = WAVETABLE_FILE;
+void* wavetable_map = MAP_FAILED;
+size_t wavetable_map_size;
+struct wg_tables* wavetables = NULL;                // Library view of the mapped file, shared by host engines
+const float* wavetable[WT_NUM_TABLES];
+const float* wavetable_small[WT_NUM_TABLES];        // Decimated copies for QUALITY_SMALL_TABLES
+float* wavetable_small_data = NULL;                 // Allocation wavetable_small[] points into
+struct sample_file playback = {NULL, 0, 0, SAMPLE_FORMAT_INT16, SAMPLE_RATE, 0.0, FALSE, 0};
+struct partial partials[MAX_PARTIALS];
+int num_partials = 0;
+double additive_table[WAVETABLE_SIZE];              // Cached period of the partial sum
+double additive_small[SMALL_TABLE_SIZE];
+char* modulation_targets[] = {"none", "am", "fm", "pm"};
+struct modulation modulation = {MOD_NONE, 0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0};
+char* sweep_laws[] = {"lin", "log"};
+struct sweep sweep = {1.0, FREQUENCY_MAX, 10.0, SWEEP_LINEAR, FALSE, 0.0, 0.0, 0.0, 0, -1};
+struct noise_state noise;
+struct envelope envelope = {FALSE, FALSE, FALSE, 0, {0}, {0}, 0, ENV_IDLE, 0, 0.0, 0.0};
+char* trigger_modes[] = {"none", "start", "stop", "gate"};
+struct snapshot snapshot;
+struct trigger trigger = {TRIGGER_NONE, TRUE, 0, {0, 0}, 0, 0, 0, 0.0};
+FILE* control_fp = NULL;                            // Open while recording with -R
+uint64_t sample_clock = 0;                          // Output samples since start, advanced by the generator only
+char* trace_file = NULL;
+struct trace_ring* trace_rings[TRACE_THREADS];
+int trace_num_rings = 0;
+__thread struct trace_ring* trace_local = NULL;     // Ring of the calling thread, NULL when not tracing
+volatile sig_atomic_t trace_dump_requested = 0;
+char* profile_file = NULL;                          // -F, reports are written when set
+bool profiling = FALSE;                             // Threads take profile slots, set by -F and -X
+struct profile_thread profile_threads[PROFILE_THREADS];
+int profile_num_threads = 0;
+__thread struct profile_thread* profile_local = NULL;
+uint64_t profile_start;
+volatile sig_atomic_t profile_report_requested = 0;
+char* lock_names[] = {"global_mutex", "board_mutex", "shutdown_mutex"};
+#ifdef SIMULATION
+uint16_t sim_io[SIM_IO_PORTS];
+FILE* sim_dac_log = NULL;                            // Capture of first board DAC writes, from SIM_DAC_LOG
+uint8_t sim_dio_in;                                 // Level driven onto DIO_PORTB by sim_trigger_line()
+struct timespec sim_dio_edge;                       // When sim_dio_in last changed
+pthread_mutex_t sim_dio_mutex = PTHREAD_MUTEX_INITIALIZER;  // Keeps sim_dio_in and sim_dio_edge consistent
+int sim_boards = 1;                                 // Virtual boards found by pci_attach_device(), from SIM_BOARDS
+struct stress stress;
+char* stress_modes[] = {"random", "adversarial"};
+#endif
 
 // Multithreading variables
 pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t shutdown_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t  shutdown_cond  = PTHREAD_COND_INITIALIZER;
+pthread_cond_t  param_cond     = PTHREAD_COND_INITIALIZER;  // Signalled with global_mutex held when parameters change
+unsigned long param_version = 0;                            // Incremented on every parameter change
+unsigned long output_version = 0;                           // param_version of the codes the generator is writing
+pthread_mutex_t board_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  board_cond  = PTHREAD_COND_INITIALIZER;     // Signalled when board_block is replaced
 
 // Function Prototypes
 void usage(char* progname);
@@ -82,8 +644,106 @@ bool convertNum(char* input, void* var_pointer, int format, float min, float max
 int promptInt(char* msg, int min, int max);
 float promptFloat(char* msg, float min, float max);
 void* get_keyboard_input();
+void read_key_batch(struct key_batch* batch);
+void apply_key_batch(const struct key_batch* batch);
+void draw_screen();
+bool open_control(struct control* ctl, const sigset_t* signals, char* partial_path, char* command_path);
+void control_loop(struct control* ctl);
+void close_control(struct control* ctl);
+bool read_command(struct command_client* client);
+bool run_command(char* line, char* reply, size_t size);
+int key_steps(int ch);
 void constrain(void* var_pointer, float min, float max, int format);
-void* output_result();
+void update_output();
+bool build_wavetables(char* path);
+bool load_wavetables(char* path);
+const float* bandlimited_table(int first_level, double freq, double rate);
+double render_block(unsigned int* block, int n, double phase);
+void write_dac(struct board* board, unsigned int value);
+bool open_sample_file(char* path);
+double read_sample(size_t index);
+bool load_partials(char* path);
+void apply_partials(const struct partial* new_partials, int num_new);
+void add_partials(double* table, const struct partial* list, int count);
+bool same_partial(const struct partial* a, const struct partial* b);
+bool parse_modulation(char* spec);
+double lfo_value(double phase, double rate);
+bool parse_sweep(char* spec);
+void start_sweep();
+void seed_noise(uint32_t seed);
+void noise_fill(double* out, int n);
+bool parse_envelope(char* spec, bool adsr);
+void start_segment(int stage);
+void apply_envelope(double* shape, int n);
+void wait_next_sample(struct timespec* deadline);
+void advance_deadline(struct timespec* t, long ns);
+void publish_board_block(const unsigned int* block, int n, const struct timespec* start);
+void* board_output(void* arg);
+void record_lateness(struct board* board, const struct timespec* due);
+void print_board_timing();
+bool open_tap(char* name);
+int bank_add_channel(struct channel_bank* bank, int waveform, float freq, float offset, float gain);
+void render_bank(struct channel_bank* bank, float* out, int n);
+void run_bank_benchmark(int channels);
+const void* waveform_table(int waveform, double freq, double rate);
+const float* active_table(int t);
+int active_table_size();
+double read_table(const float* table, double phase);
+bool watchdog_update(double headroom);
+void set_quality(int level);
+void deque_push(struct work_deque* deque, int job);
+int deque_pop(struct work_deque* deque);
+int deque_steal(struct work_deque* deque);
+void* host_worker(void* arg);
+void run_host(int instances, int workers);
+void publish_tap(const unsigned int* block, int n, uint64_t first_sample);
+bool phase_driven(int waveform);
+bool is_dc_output();
+void notify_param_change();
+void select_kernel(struct render_plan* plan, int format, int channels);
+void publish_snapshot(const unsigned int* block, int n);
+bool read_snapshot(float* dst);
+void fft(double* re, double* im, int n);
+void draw_scope(const float* samples);
+void draw_spectrum(const float* samples);
+void run_analysis(float seconds);
+bool start_recording(char* path, uint32_t seed);
+void record_control(uint64_t sample, uint32_t flags);
+void record_partials(const struct partial* list, int count);
+bool run_replay(char* path, char* output_path, char* capture_path);
+struct capture_entry* read_capture(char* path, size_t* count);
+void trace_register(char* name);
+uint64_t trace_clock();
+void trace_record(uint32_t type, uint32_t arg);
+void trace_span(uint32_t type, uint64_t start);
+void lock_globals();
+bool dump_trace(char* path);
+void request_trace_dump(int sig);
+void lock_mutex(pthread_mutex_t* mutex, int lock);
+void wait_condition(pthread_cond_t* cond, pthread_mutex_t* mutex, int lock);
+void profile_register(char* name);
+void profile_sample();
+void profile_snapshot();
+void print_profile(FILE* fp);
+void append_profile();
+void request_profile_report(int sig);
+void analyse_signal(char* path_name, double* x, int n, double ns_per_sample);
+bool poll_trigger();
+void record_trigger_latency();
+#ifdef SIMULATION
+void* sim_trigger_line();
+uint8_t sim_read_dio(struct timespec* edge);
+bool parse_stress(char* spec);
+bool run_stress(uint32_t seed);
+void* stress_updater(void* arg);
+void stress_params(struct stress_slot* next, struct stress_updater* self);
+void stress_publish(unsigned long version, uint64_t published_ns);
+void stress_write(unsigned int code);
+void stress_start_version(unsigned long version);
+double stress_bound(const struct stress_slot* params);
+int compare_u64(const void* a, const void* b);
+double percentile(const uint64_t* sorted, uint64_t n, double p);
+#endif
 
 //vars
 float current_freq;
@@ -92,119 +752,975 @@ unsigned int current_amp;
 int current_wf;
 
 // Waveform Functions
-unsigned int sine(int step);
-unsigned int square(int step);
-unsigned int sawtooth(int step);
-unsigned int triangular(int step);
-unsigned int (*waveformArray[]) (int) = {sine, square, sawtooth, triangular};
+void sine(double* out, const double* phase, int n);
+void square(double* out, const double* phase, int n);
+void sawtooth(double* out, const double* phase, int n);
+void triangular(double* out, const double* phase, int n);
+void arbitrary(double* out, const double* phase, int n);
+void additive(double* out, const double* phase, int n);
+void chirp(double* out, const double* phase, int n);
+void white(double* out, const double* phase, int n);
+void pink(double* out, const double* phase, int n);
+void bandnoise(double* out, const double* phase, int n);
+void (*waveformArray[]) (double*, const double*, int) = {sine, square, sawtooth, triangular, arbitrary, additive, chirp,
+                                                         white, pink, bandnoise};
+
+// Specialised Render Kernels
+// One loop per waveform x format x channel count with the shape, scaling and conversion inlined,
+// so the hot loop has no indirect calls, no global reads and no branches on waveform type.
+// Table reads are the engine library's, so wg_render() and these kernels read tables the same way.
+#define SHAPE_TABLE(table, p) WG_READ_NEAREST((const float*)(table), table_size, p)
+#define SHAPE_ADDITIVE(table, p) WG_READ_NEAREST((const double*)(table), table_size, p)
+#define SHAPE_TRIANGULAR(table, p) WG_TRIANGULAR_SHAPE(p)
+#define SHAPE_TABLE_LERP(table, p) WG_READ_LERP((const float*)(table), table_size, p)
+#define SHAPE_ADDITIVE_LERP(table, p) WG_READ_LERP((const double*)(table), table_size, p)
+#define TO_CODE(v) ((v) > 0.0 ? (unsigned int)(v) : 0)
+#define TO_FLOAT(v) ((float)(v))
+
+#define DEFINE_KERNEL(wave, SHAPE, fmt, TYPE, CONVERT, CHANNELS) \
+double render_##wave##_##fmt##_##CHANNELS(void* out, int n, double phase, const struct render_plan* plan) { \
+    TYPE* dst = (TYPE*)out; \
+    const void* table = plan->table; \
+    const int table_size = plan->table_size; \
+    const double phase_inc = plan->phase_inc, offset = plan->offset, gain = plan->gain; \
+    double v; \
+    int k, c; \
+    (void)table;                                    /* SHAPE_TRIANGULAR is computed, not read */ \
+    (void)table_size; \
+    for (k = 0; k < n; k++) { \
+        v = (SHAPE(table, phase) + offset) * gain; \
+        for (c = 0; c < CHANNELS; c++) dst[k * CHANNELS + c] = CONVERT(v); \
+        phase += phase_inc; \
+        if (phase >= 1.0) phase -= 1.0; \
+    } \
+    return phase; \
+}
+
+#define DEFINE_KERNELS(wave, SHAPE) \
+    DEFINE_KERNEL(wave, SHAPE, code, unsigned int, TO_CODE, 1) \
+    DEFINE_KERNEL(wave, SHAPE, code, unsigned int, TO_CODE, 2) \
+    DEFINE_KERNEL(wave, SHAPE, float, float, TO_FLOAT, 1) \
+    DEFINE_KERNEL(wave, SHAPE, float, float, TO_FLOAT, 2)
+
+#define KERNEL_ROW(wave) {{render_##wave##_code_1, render_##wave##_code_2}, {render_##wave##_float_1, render_##wave##_float_2}}
+#define NO_KERNEL_ROW {{NULL, NULL}, {NULL, NULL}}
+
+DEFINE_KERNELS(sine, SHAPE_TABLE)
+DEFINE_KERNELS(square, SHAPE_TABLE)
+DEFINE_KERNELS(sawtooth, SHAPE_TABLE)
+DEFINE_KERNELS(triangular, SHAPE_TRIANGULAR)
+DEFINE_KERNELS(additive, SHAPE_ADDITIVE)
+DEFINE_KERNELS(sine_lerp, SHAPE_TABLE_LERP)
+DEFINE_KERNELS(square_lerp, SHAPE_TABLE_LERP)
+DEFINE_KERNELS(sawtooth_lerp, SHAPE_TABLE_LERP)
+DEFINE_KERNELS(additive_lerp, SHAPE_ADDITIVE_LERP)
+
+// Same order as waveform_options, stateful waveforms have no kernel
+render_kernel kernelArray[][NUM_FORMATS][MAX_CHANNELS] = {
+    KERNEL_ROW(sine), KERNEL_ROW(square), KERNEL_ROW(sawtooth), KERNEL_ROW(triangular), NO_KERNEL_ROW,
+    KERNEL_ROW(additive), NO_KERNEL_ROW, NO_KERNEL_ROW, NO_KERNEL_ROW, NO_KERNEL_ROW
+};
+
+// Interpolating the same way as read_table(), for QUALITY_FULL. Triangular is computed exactly either way
+render_kernel lerpKernelArray[][NUM_FORMATS][MAX_CHANNELS] = {
+    KERNEL_ROW(sine_lerp), KERNEL_ROW(square_lerp), KERNEL_ROW(sawtooth_lerp), KERNEL_ROW(triangular), NO_KERNEL_ROW,
+    KERNEL_ROW(additive_lerp), NO_KERNEL_ROW, NO_KERNEL_ROW, NO_KERNEL_ROW, NO_KERNEL_ROW
+};
+
 void* waveform_generator() {
     // Thread for generating waveform
-    int step = 0;
+    unsigned int block[BLOCK_SIZE];
+    double phase = 0.0;
+    struct timespec deadline, hold_start, start;
+    bool sync_high = FALSE, first_sample = FALSE;
+    struct render_plan plan;
+    unsigned long version, recorded = param_version - 1;
+    bool restarted = FALSE, rewound = FALSE;
+    int n, sync_sample;
+    uint64_t render_start;
+    double headroom;
+    uintptr_t* iobase = boards[0].iobase;            // Sync marker and trigger line are on the first board
+
+    trace_register("generator");
+    profile_register("generator");
+    plan.version = param_version - 1;
+    watchdog.start = trace_clock();
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
     while (TRUE) {
-        pthread_mutex_lock(&global_mutex);
-        output = waveformArray[current_waveform](step);
+        lock_globals();
+        if (trigger.mode == TRIGGER_NONE && is_dc_output()) {
+            // DC hold: write the constant once and sleep until a parameter changes
+            if (control_fp != NULL) record_control(sample_clock, CONTROL_HOLD);
+            output_version = param_version;
+            render_block(block, 1, phase);
+            output = block[0];
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            write_dac(&boards[0], output);
+            publish_board_block(block, 1, &deadline);
+            publish_tap(block, 1, sample_clock);
+            version = param_version;
+            hold_start = deadline;
+            while (version == param_version) {
+                wait_condition(&param_cond, &global_mutex, LOCK_GLOBAL);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+            // Keep the sample clock running through the hold so recorded changes land where they were heard
+            sample_clock += ((deadline.tv_sec - hold_start.tv_sec) * 1000000000LL +
+                             (deadline.tv_nsec - hold_start.tv_nsec)) / SAMPLE_PERIOD_NS;
+            advance_deadline(&deadline, -SAMPLE_PERIOD_NS);
+            rewound = TRUE;
+            pthread_mutex_unlock(&global_mutex);
+            profile_sample();
+            continue;
+        }
         pthread_mutex_unlock(&global_mutex);
-	
-        // Output Data to DAC
-        out16(DA_CTLREG, 0x0a23);
-        out16(DA_FIFOCLR, 0);
-        out16(DA_Data, (short)output);																																		
-        out16(DA_CTLREG, 0x0a43);
-        out16(DA_FIFOCLR, 0);
-        out16(DA_Data, (short)output);	
-        
-         delay((10/frequency)-2);				//testing
-              
-        step += 1;
-        if (step == STEPS) step = 0;
-		
-        // Sleep in microseconds
-        //freq_delay = (useconds_t) 1000000.0/frequency/100.0;
-        //usleep(freq_delay);
-        //sleep(1.0/frequency/200.0);
+
+        if (!trigger.running) {
+            // Armed: hold the idle level and watch the trigger line on the sample clock
+            lock_globals();
+            output = (unsigned int)(mean * amplitude);
+            output_version = param_version;
+            if (control_fp != NULL) record_control(sample_clock, CONTROL_ARMED);
+            pthread_mutex_unlock(&global_mutex);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            write_dac(&boards[0], output);
+            block[0] = output;
+            publish_board_block(block, 1, &start);
+            publish_tap(block, 1, sample_clock);
+            while (!poll_trigger()) {
+                wait_next_sample(&deadline);
+            }
+
+            // Start a fresh burst immediately instead of waiting for the next tick
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            advance_deadline(&deadline, -SAMPLE_PERIOD_NS);
+            phase = 0.0;
+            first_sample = TRUE;
+            restarted = TRUE;
+            rewound = TRUE;
+        }
+
+        lock_globals();
+        render_start = trace_clock();
+        if (plan.version != param_version) select_kernel(&plan, FORMAT_CODE, 1);
+        output_version = param_version;
+        // The block is written from the next sample tick on, so that is where the parameters take effect
+        if (control_fp != NULL && (recorded != param_version || restarted)) {
+            record_control(sample_clock + 1, restarted ? CONTROL_START : 0);
+            recorded = param_version;
+        }
+        restarted = FALSE;
+        sweep.sync_sample = -1;
+        if (plan.kernel != NULL) {
+            phase = plan.kernel(block, BLOCK_SIZE, phase, &plan);
+        }
+        else {
+            phase = render_block(block, BLOCK_SIZE, phase);
+        }
+        sync_sample = sweep.sync ? sweep.sync_sample : -1;
+        trace_span(TRACE_BLOCK, render_start);
+        pthread_mutex_unlock(&global_mutex);
+        publish_snapshot(block, BLOCK_SIZE);
+
+        // Rendered a sample period ahead, so the other boards are waiting on the same deadline as this one
+        start = deadline;
+        advance_deadline(&start, SAMPLE_PERIOD_NS);
+        publish_board_block(block, BLOCK_SIZE, &start);
+
+        // A rewound deadline is due now by design, so the block after a hold or a trigger is not measured
+        headroom = ((double)start.tv_sec * 1e9 + start.tv_nsec - (double)trace_clock()) / SAMPLE_PERIOD_NS;
+        if (rewound) {
+            rewound = FALSE;
+        }
+        else if (watchdog_update(headroom)) {
+            // Select the plan again and record the new quality with the next block
+            plan.version = param_version - 1;
+            recorded = plan.version;
+        }
+        profile_sample();
+
+        for (n = 0; n < BLOCK_SIZE; n++) {
+            wait_next_sample(&deadline);
+            output = block[n];
+            write_dac(&boards[0], output);
+            if (num_boards > 1) record_lateness(&boards[0], &deadline);
+            if (first_sample) {
+                record_trigger_latency();
+                first_sample = FALSE;
+            }
+
+            // Sync marker is held high for the first sample of a sweep
+            if (sync_high) {
+                out8(DIO_PORTA, 0);
+                sync_high = FALSE;
+            }
+            if (n == sync_sample) {
+                out8(DIO_PORTA, SYNC_MARKER);
+                sync_high = TRUE;
+            }
+
+            if (trigger.mode != TRIGGER_NONE && poll_trigger() && !trigger.running) break;
+        }
+
+        // Publish only what reached the DAC, a stop trigger can end the block early
+        n = n < BLOCK_SIZE ? n + 1 : BLOCK_SIZE;
+        publish_tap(block, n, sample_clock + 1 - n);
     }
     
 }
 
-void* shutdown() {
-    // For demonstration of shutdown of all threads using conditional variable
-    //sleep(10000);
-    
-    // Signal main thread to shutdown all threads and exit program
-    pthread_mutex_lock(&shutdown_mutex);
-    pthread_cond_signal(&shutdown_cond);
-    pthread_mutex_unlock(&shutdown_mutex);
-    pthread_exit(NULL);
+void publish_snapshot(const unsigned int* block, int n) {
+    // Strided copy of a rendered block into the snapshot ring, the UI thread does all other scope work
+    unsigned long written = snapshot.written;
+    int k;
+
+    __atomic_store_n(&snapshot.sequence, snapshot.sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (k = snapshot.skip; k < n; k += SCOPE_DECIMATION) {
+        snapshot.samples[written++ % SCOPE_SIZE] = block[k];
+    }
+    snapshot.skip = k - n;
+    snapshot.written = written;
+    __atomic_store_n(&snapshot.sequence, snapshot.sequence + 1, __ATOMIC_RELEASE);
 }
 
-int main(int argc, char **argv)
-{
-    // PCI Variables Declaration
-	struct pci_dev_info info;
-	void *hdl;
-	
-	uintptr_t dio_in;
-	uint16_t adc_in;
-    int badr[5];
-	
-    // Thread Variables Declaration
-    pthread_t kb_thread, waveform_thread, output_thread, shutdown_thread;
-    
-    // Command Line Argument Variables Declaration
-    int opt;
-    bool f_opt = FALSE, m_opt = FALSE, a_opt = FALSE, s_opt = FALSE, w_opt = FALSE;
+bool read_snapshot(float* dst) {
+    /*
+    Copies the latest SCOPE_SIZE snapshot samples, oldest first, without blocking the generator.
+    The copy is retried if the generator was writing when it started or wrote while it was taken.
 
-    // Parse Command Line Arguments
-    while ((opt = getopt(argc, argv, ":f:m:a:w:s")) != -1) {
-        char arg[MAX_INPUT] = "";
-        switch (opt) {
-        case 'f':
-            f_opt = TRUE;
-            // printf("Argument to f is %s\n", optarg);
-            if (!convertNum(optarg, &frequency, FLOAT, FREQUENCY_MIN, FREQUENCY_MAX)) {
-                usage(argv[0]);
+    Parameters:
+        dst: buffer of SCOPE_SIZE samples
+
+    Returns:
+        TRUE when a consistent copy was made, else FALSE
+    */
+    unsigned long sequence, start, end;
+    int attempt, k;
+
+    for (attempt = 0; attempt < 3; attempt++) {
+        sequence = __atomic_load_n(&snapshot.sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) continue;
+        end = snapshot.written;
+        if (end < SCOPE_SIZE) return FALSE;
+        start = end - SCOPE_SIZE;
+        for (k = 0; k < SCOPE_SIZE; k++) {
+            dst[k] = snapshot.samples[(start + k) % SCOPE_SIZE];
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&snapshot.sequence, __ATOMIC_RELAXED) == sequence) return TRUE;
+    }
+    return FALSE;
+}
+
+bool phase_driven(int waveform) {
+    // Returns TRUE for waveforms that are a pure function of the phase array
+    return waveformArray[waveform] == sine || waveformArray[waveform] == square || waveformArray[waveform] == sawtooth ||
+           waveformArray[waveform] == triangular || waveformArray[waveform] == additive;
+}
+
+bool is_dc_output() {
+    /*
+    Checks whether the current parameters can only produce a constant output.
+    That is zero amplitude, or zero frequency on a phase driven waveform with nothing else moving.
+    Caller must hold global_mutex.
+
+    Returns:
+        TRUE when the output is constant, else FALSE
+    */
+    if (amplitude == 0) return TRUE;
+    if (frequency != 0 || !phase_driven(current_waveform)) return FALSE;
+    if (modulation.target != MOD_NONE) return FALSE;
+    if (envelope.enabled && (envelope.gate != envelope.gated || envelope.remaining != 0 ||
+                             (envelope.stage >= 0 && envelope.stage < envelope.num_points))) return FALSE;
+    return TRUE;
+}
+
+void notify_param_change() {
+    // Wakes the generator from DC hold, caller must hold global_mutex
+    param_version++;
+    trace_record(TRACE_PARAM_CHANGE, (uint32_t)param_version);
+    pthread_cond_signal(&param_cond);
+}
+
+void wait_next_sample(struct timespec* deadline) {
+    // Sleep until the next sample against an absolute deadline so the rate does not drift
+    uint64_t now, due;
+
+    advance_deadline(deadline, SAMPLE_PERIOD_NS);
+    if (trace_local != NULL) {
+        now = trace_clock();
+        due = (uint64_t)deadline->tv_sec * 1000000000 + deadline->tv_nsec;
+        if (now > due) trace_record(TRACE_DEADLINE_MISS, (uint32_t)(now - due));
+    }
+    sample_clock++;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+}
+
+void advance_deadline(struct timespec* t, long ns) {
+    // Moves t by ns, which may be negative, keeping tv_nsec within [0, 1s)
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000) {
+        t->tv_nsec -= 1000000000;
+        t->tv_sec += 1;
+    }
+    while (t->tv_nsec < 0) {
+        t->tv_nsec += 1000000000;
+        t->tv_sec -= 1;
+    }
+}
+
+void publish_board_block(const unsigned int* block, int n, const struct timespec* start) {
+    /*
+    Hands a block to the output threads of the other boards, replacing any block they have not finished.
+    Does nothing with a single board.
+
+    Parameters:
+        block: DAC codes to output
+        n: number of samples, at most BLOCK_SIZE
+        start: shared clock deadline of the first sample
+    */
+    if (num_boards < 2) return;
+    lock_mutex(&board_mutex, LOCK_BOARD);
+    memcpy(board_block.samples, block, n * sizeof(unsigned int));
+    board_block.n = n;
+    board_block.start = *start;
+    board_block.seq++;
+    pthread_cond_broadcast(&board_cond);
+    pthread_mutex_unlock(&board_mutex);
+}
+
+void* board_output(void* arg) {
+    // Thread writing each published block to one additional board, sample k at the shared deadline start + k periods
+    struct board* board = arg;
+    unsigned int block[BLOCK_SIZE];
+    struct timespec deadline;
+    unsigned long seq = 0;
+    char name[TRACE_NAME_SIZE];
+    int n, k;
+
+    snprintf(name, sizeof(name), "board %d", (int)(board - boards));
+    profile_register(name);
+    while (TRUE) {
+        lock_mutex(&board_mutex, LOCK_BOARD);
+        while (board_block.seq == seq) {
+            wait_condition(&board_cond, &board_mutex, LOCK_BOARD);
+        }
+        if (seq != 0) board->missed += board_block.seq - seq - 1;
+        seq = board_block.seq;
+        n = board_block.n;
+        deadline = board_block.start;
+        memcpy(block, board_block.samples, n * sizeof(unsigned int));
+        pthread_mutex_unlock(&board_mutex);
+
+        for (k = 0; k < n; k++) {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+            write_dac(board, block[k]);
+            record_lateness(board, &deadline);
+            advance_deadline(&deadline, SAMPLE_PERIOD_NS);
+
+            // A newer block means the generator stopped, held or restarted, follow it immediately
+            if (k + 1 < n && __atomic_load_n(&board_block.seq, __ATOMIC_RELAXED) != seq) {
+                board->missed++;
+                break;
             }
+        }
+        profile_sample();
+    }
+}
+
+void record_lateness(struct board* board, const struct timespec* due) {
+    // Accumulates how far a sample write fell behind its shared clock deadline
+    struct timespec now;
+    uint64_t due_ns = (uint64_t)due->tv_sec * 1000000000 + due->tv_nsec;
+    int slot = (due_ns / SAMPLE_PERIOD_NS) % SKEW_HISTORY;
+    long late;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = (now.tv_sec - due->tv_sec) * 1000000000 + (now.tv_nsec - due->tv_nsec);
+    board->due_at[slot] = due_ns;
+    board->late_at[slot] = late;
+    board->late_total += late;
+    if (late > board->late_max) board->late_max = late;
+    board->late_count++;
+}
+
+bool open_tap(char* name) {
+    /*
+    Creates the shared-memory tap and fills in its header, magic last so readers never see a half-made tap.
+
+    Parameters:
+        name: shm_open() name, starting with '/'
+
+    Returns:
+        TRUE when the tap is mapped, else FALSE
+    */
+    int fd;
+
+    if ((fd = shm_open(name, O_CREAT | O_RDWR, 0644)) == -1) return FALSE;
+    if (ftruncate(fd, sizeof(struct tap_header)) == -1) {
+        close(fd);
+        return FALSE;
+    }
+    tap = mmap(NULL, sizeof(struct tap_header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (tap == MAP_FAILED) {
+        tap = NULL;
+        return FALSE;
+    }
+
+    memset(tap, 0, sizeof(struct tap_header));
+    tap->version = TAP_VERSION;
+    tap->sample_rate = SAMPLE_RATE;
+    tap->slots = TAP_SLOTS;
+    __atomic_store_n(&tap->magic, TAP_MAGIC, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+void publish_tap(const unsigned int* block, int n, uint64_t first_sample) {
+    /*
+    Writes a block into the next tap slot. Never waits for readers: a slow reader finds
+    the slot sequence changed and skips the block instead.
+
+    Parameters:
+        block: DAC codes sent to the board
+        n: number of samples, at most TAP_BLOCK_SAMPLES
+        first_sample: output sample index of block[0]
+    */
+    struct tap_slot* slot;
+    uint64_t head;
+    int k;
+
+    if (tap == NULL) return;
+    head = tap->head;
+    slot = &tap->slot[head & (TAP_SLOTS - 1)];
+
+    __atomic_store_n(&slot->seq, 2 * head + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sample = first_sample;
+    slot->n = n;
+    for (k = 0; k < n; k++) {
+        slot->samples[k] = (uint16_t)block[k];
+    }
+    __atomic_store_n(&slot->seq, 2 * head + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&tap->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void print_board_timing() {
+    /*
+    Prints how far each board's writes fell behind the shared clock, and the skew between boards.
+    Skew is the spread of write times across boards for the same sample, over the last SKEW_HISTORY samples
+    that every board wrote.
+    */
+    long late, earliest, latest, skew_max = 0;
+    double skew_total = 0.0;
+    int b, slot, samples = 0;
+
+    for (b = 0; b < num_boards; b++) {
+        if (boards[b].late_count == 0) continue;
+        printf("Board %d: %ld samples, mean %.1f us, max %.1f us behind the shared clock, %lu blocks cut short\n",
+               b, boards[b].late_count, boards[b].late_total / boards[b].late_count / 1000.0,
+               boards[b].late_max / 1000.0, boards[b].missed);
+    }
+
+    for (slot = 0; slot < SKEW_HISTORY; slot++) {
+        earliest = latest = boards[0].late_at[slot];
+        for (b = 1; b < num_boards && boards[b].due_at[slot] == boards[0].due_at[slot]; b++) {
+            late = boards[b].late_at[slot];
+            if (late < earliest) earliest = late;
+            if (late > latest) latest = late;
+        }
+        if (b < num_boards || boards[0].due_at[slot] == 0) continue;
+        skew_total += latest - earliest;
+        if (latest - earliest > skew_max) skew_max = latest - earliest;
+        samples++;
+    }
+    if (samples > 0) {
+        printf("Inter-board skew over %d samples: mean %.1f us, max %.1f us\n",
+               samples, skew_total / samples / 1000.0, skew_max / 1000.0);
+    }
+}
+
+bool poll_trigger() {
+    /*
+    Reads TRIGGER_LINE once and applies the trigger mode to any edge.
+    Called from the output loop at the sample clock, so no extra polling thread is needed.
+
+    Returns:
+        TRUE when output was started or stopped, else FALSE
+    */
+    bool was_running = trigger.running;
+#ifdef SIMULATION
+    // Simulated lines know exactly when the edge happened, read together with the level
+    struct timespec edge;
+    uint8_t level = sim_read_dio(&edge) & TRIGGER_LINE;
+#else
+    uintptr_t* iobase = boards[0].iobase;
+    uint8_t level = in8(DIO_PORTB) & TRIGGER_LINE;
+#endif
+
+    // Only the generator thread polls, so level needs no lock, the fields the UI reads are written under global_mutex
+    if (level == trigger.level) return FALSE;
+    trigger.level = level;
+
+    lock_globals();
+    switch (trigger.mode) {
+        case TRIGGER_START:
+            if (level) trigger.running = TRUE;
             break;
-        case 'm':
-            m_opt = TRUE;
-            // printf("Argument to m is %s\n", optarg);
-            if (!convertNum(optarg, &mean, FLOAT, MEAN_MIN, MEAN_MAX)) {
-                usage(argv[0]);
-            }
+        case TRIGGER_STOP:
+            if (level) trigger.running = !was_running;
             break;
-        case 'a':
-            a_opt = TRUE;
-            // printf("Argument to a is %s\n", optarg);
-            if (!convertNum(optarg, &amplitude, INTEGER, AMPLITUDE_MIN, AMPLITUDE_MAX)) {
-                usage(argv[0]);
-            }
+        case TRIGGER_GATE:
+            trigger.running = (level != 0);
             break;
-        case 'w':
-            w_opt = TRUE;
-            
-            // Convert string to lowercase
-            for(i = 0; optarg[i]; i++) {
-                optarg[i] = tolower(optarg[i]);
-            }
-            
-            // Match option argument to waveform options
-            for (i=0; i<len_waveform; i++) {
-                if (strcmp(optarg, waveform_options[i]) == 0) {
-                    current_waveform = i;
-                    break;
-                }
+    }
+
+    if (trigger.running && !was_running) {
+#ifdef SIMULATION
+        trigger.edge_time = edge;
+#else
+        clock_gettime(CLOCK_MONOTONIC, &trigger.edge_time);
+#endif
+    }
+    pthread_mutex_unlock(&global_mutex);
+    return trigger.running != was_running;
+}
+
+void record_trigger_latency() {
+    // Accumulates time from the trigger edge to the first sample written to the DAC
+    struct timespec now;
+    long latency;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    lock_globals();
+    latency = (now.tv_sec - trigger.edge_time.tv_sec) * 1000000000 + (now.tv_nsec - trigger.edge_time.tv_nsec);
+    trigger.last_ns = latency;
+    if (latency > trigger.max_ns) trigger.max_ns = latency;
+    trigger.total_ns += latency;
+    trigger.count++;
+    pthread_mutex_unlock(&global_mutex);
+}
+
+double render_block(unsigned int* block, int n, double phase) {
+    /*
+    Renders n samples of the current waveform into block as DAC codes.
+    Phase advances by frequency/SAMPLE_RATE per sample, so output rate is independent of the table size.
+    Caller must hold global_mutex.
+
+    Parameters:
+        block: buffer to store DAC codes in
+        n: number of samples to render, at most BLOCK_SIZE
+        phase: phase of the first sample, in cycles [0, 1)
+
+    Returns:
+        phase of the sample following the block
+    */
+    double phases[BLOCK_SIZE];
+    double shape[BLOCK_SIZE];
+    double phase_inc = frequency / SAMPLE_RATE;
+    double value, lfo, lfo_step;
+    int k, span;
+
+    // Evaluate the LFO once per block, or every CONTROL_DIVIDER blocks under load, and ramp linearly to it
+    lfo = modulation.ramp;
+    if (modulation.target != MOD_NONE && --modulation.countdown <= 0) {
+        modulation.countdown = quality >= QUALITY_LOW_CONTROL ? CONTROL_DIVIDER : 1;
+        span = n * modulation.countdown;
+        modulation.phase += modulation.frequency * span / SAMPLE_RATE;
+        modulation.phase -= floor(modulation.phase);
+        modulation.value = lfo_value(modulation.phase, (double)SAMPLE_RATE / span);
+        modulation.step = (modulation.value - lfo) / span;
+    }
+    lfo_step = modulation.step;
+
+    switch (modulation.target) {
+        case MOD_FM:
+            for (k = 0; k < n; k++) {
+                phases[k] = phase;
+                lfo += lfo_step;
+                phase += phase_inc * (1.0 + modulation.depth * lfo);
+                phase -= floor(phase);
             }
-            
-            if (current_waveform == -1) {
-                printf("Undefined Waveform\n");
-                usage(argv[0]);
+            break;
+        case MOD_PM:
+            for (k = 0; k < n; k++) {
+                lfo += lfo_step;
+                value = phase + modulation.depth * lfo;
+                phases[k] = value - floor(value);
+                phase += phase_inc;
+                if (phase >= 1.0) phase -= 1.0;
             }
             break;
-        case 's':
+        default:
+            for (k = 0; k < n; k++) {
+                phases[k] = phase;
+                phase += phase_inc;
+                if (phase >= 1.0) phase -= 1.0;
+            }
+    }
+
+    // Chirp integrates its own phase, so it takes the FM or PM term of each sample instead
+    if (waveformArray[current_waveform] == chirp) {
+        value = modulation.ramp;
+        for (k = 0; k < n; k++) {
+            value += lfo_step;
+            phases[k] = modulation.target == MOD_FM || modulation.target == MOD_PM ? modulation.depth * value : 0.0;
+        }
+    }
+
+    waveformArray[current_waveform](shape, phases, n);
+
+    if (modulation.target == MOD_AM) {
+        for (k = 0; k < n; k++) {
+            lfo += lfo_step;
+            shape[k] *= 1.0 + modulation.depth * lfo;
+        }
+    }
+
+    if (modulation.target != MOD_NONE) modulation.ramp = lfo;
+    if (envelope.enabled) apply_envelope(shape, n);
+
+    // Clamp at zero, band-limited edges overshoot below -1
+    for (k = 0; k < n; k++) {
+        value = (shape[k] + mean) * amplitude;
+        block[k] = value > 0.0 ? (unsigned int)value : 0;
+    }
+    return phase;
+}
+
+void select_kernel(struct render_plan* plan, int format, int channels) {
+    /*
+    Picks the specialised kernel for the current parameters, called only when param_version changes.
+    QUALITY_FULL gets the interpolating kernels, lower qualities the nearest-entry ones.
+    Modulation and envelopes need the general render_block() path, so the plan's kernel is left NULL for them.
+    Caller must hold global_mutex.
+
+    Parameters:
+        plan: plan to fill
+        format: FORMAT_CODE or FORMAT_FLOAT
+        channels: interleaved channels per sample, 1 to MAX_CHANNELS
+    */
+    plan->version = param_version;
+    plan->kernel = NULL;
+    if (modulation.target != MOD_NONE || envelope.enabled) return;
+
+    if (quality == QUALITY_FULL) plan->kernel = lerpKernelArray[current_waveform][format][channels - 1];
+    else plan->kernel = kernelArray[current_waveform][format][channels - 1];
+    plan->phase_inc = frequency / SAMPLE_RATE;
+    plan->offset = mean;
+    plan->gain = amplitude;
+    plan->table = waveform_table(current_waveform, frequency, SAMPLE_RATE);
+    plan->table_size = active_table_size();
+}
+
+const void* waveform_table(int waveform, double freq, double rate) {
+    // Period table a kernel reads for waveform at freq and output rate, band-limited for the shapes with discontinuities
+    if (waveformArray[waveform] == square) return bandlimited_table(WT_SQUARE_BL, freq, rate);
+    if (waveformArray[waveform] == sawtooth) return bandlimited_table(WT_SAWTOOTH_BL, freq, rate);
+    if (waveformArray[waveform] == additive) return quality >= QUALITY_SMALL_TABLES ? additive_small : additive_table;
+    return active_table(waveform);
+}
+
+const float* active_table(int t) {
+    // Wavetable t at the current quality
+    return quality >= QUALITY_SMALL_TABLES ? wavetable_small[t] : wavetable[t];
+}
+
+int active_table_size() {
+    return quality >= QUALITY_SMALL_TABLES ? SMALL_TABLE_SIZE : WAVETABLE_SIZE;
+}
+
+double read_table(const float* table, double phase) {
+    // Linearly interpolated at QUALITY_FULL, nearest entry below it
+    int size = active_table_size();
+
+    if (quality != QUALITY_FULL) return WG_READ_NEAREST(table, size, phase);
+    return WG_READ_LERP(table, size, phase);
+}
+
+bool watchdog_update(double headroom) {
+    /*
+    Collects per-block headroom into windows of WATCHDOG_WINDOW blocks and moves one quality step
+    per window: down as soon as a window's worst block drops below WATCHDOG_LOW, up only after
+    WATCHDOG_RECOVER windows in a row stayed above WATCHDOG_HIGH.
+
+    Parameters:
+        headroom: share of the sample period left after rendering the block, negative when late
+
+    Returns:
+        TRUE when the quality changed and the render plan must be selected again, else FALSE
+    */
+    if (!watchdog.enabled) return FALSE;
+    if (headroom < watchdog.window_min) watchdog.window_min = headroom;
+    watchdog.window_total += headroom;
+    if (++watchdog.blocks < WATCHDOG_WINDOW) return FALSE;
+
+    watchdog.last_min = watchdog.window_min;
+    watchdog.last_mean = watchdog.window_total / watchdog.blocks;
+    watchdog.blocks = 0;
+    watchdog.window_min = 1.0;
+    watchdog.window_total = 0.0;
+
+    if (watchdog.last_min < WATCHDOG_LOW) {
+        watchdog.good_windows = 0;
+        if (quality == NUM_QUALITY - 1) return FALSE;
+        set_quality(quality + 1);
+        return TRUE;
+    }
+    if (watchdog.last_min < WATCHDOG_HIGH) {
+        watchdog.good_windows = 0;
+        return FALSE;
+    }
+    if (++watchdog.good_windows < WATCHDOG_RECOVER || quality == QUALITY_FULL) return FALSE;
+    watchdog.good_windows = 0;
+    set_quality(quality - 1);
+    return TRUE;
+}
+
+void set_quality(int level) {
+    // Switches quality and logs the transition with the window that caused it
+    char* line = watchdog.log[watchdog.transitions % WATCHDOG_LOG_SIZE];
+
+    snprintf(line, WATCHDOG_LOG_LINE, "%9.3f s: %s -> %s, headroom min %.1f%% mean %.1f%%",
+             (trace_clock() - watchdog.start) / 1e9, quality_names[quality], quality_names[level],
+             watchdog.last_min * 100, watchdog.last_mean * 100);
+    watchdog.transitions++;
+    if (watchdog.log_fp != NULL) {
+        fprintf(watchdog.log_fp, "%s\n", line);
+        fflush(watchdog.log_fp);
+    }
+    quality = level;
+}
+
+void write_dac(struct board* board, unsigned int value) {
+    // Output Data to DAC
+    uintptr_t* iobase = board->iobase;
+
+    out16(DA_CTLREG, 0x0a23);
+    out16(DA_FIFOCLR, 0);
+    out16(DA_Data, (short)value);
+    out16(DA_CTLREG, 0x0a43);
+    out16(DA_FIFOCLR, 0);
+    out16(DA_Data, (short)value);
+    trace_record(TRACE_DAC_WRITE, value);
+}
+
+int main(int argc, char **argv)
+{
+    // PCI Variables Declaration
+	struct pci_dev_info info;
+	uintptr_t* iobase;
+	
+	uintptr_t dio_in;
+	uint16_t adc_in;
+    int badr[5];
+	
+    // Thread Variables Declaration
+    pthread_t waveform_thread;
+#ifdef __linux__
+    struct control control;
+    sigset_t control_signals;
+#else
+    pthread_t kb_thread;
+#endif
+#ifdef SIMULATION
+    pthread_t sim_thread;
+#endif
+    
+    // Command Line Argument Variables Declaration
+    int opt;
+    bool f_opt = FALSE, m_opt = FALSE, a_opt = FALSE, s_opt = FALSE, w_opt = FALSE, g_opt = FALSE;
+    char* sample_path = NULL;
+    char* partial_path = NULL;
+    char* command_path = NULL;
+    float sample_rate = SAMPLE_RATE;
+    int seed = (int)time(NULL);
+    float analysis_seconds = 0.0;
+#ifndef __linux__
+    struct sigaction trace_action;
+#endif
+    char* record_path = NULL;
+    char* replay_path = NULL;
+    char* replay_output = NULL;
+    char* replay_capture = NULL;
+    int max_boards = MAX_BOARDS;
+    int bank_channels = 0;
+    int host_count = 0;
+    int host_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    char* watchdog_path = NULL;
+
+    // Parse Command Line Arguments
+    while ((opt = getopt(argc, argv, ":f:m:a:w:st:gp:r:lH:M:c:S:e:E:T:A:x:R:P:O:V:B:o:C:I:j:Q:W:U:F:X:")) != -1) {
+        char arg[MAX_INPUT] = "";
+        switch (opt) {
+        case 'f':
+            f_opt = TRUE;
+            // printf("Argument to f is %s\n", optarg);
+            if (!convertNum(optarg, &frequency, FLOAT, FREQUENCY_MIN, FREQUENCY_MAX)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'm':
+            m_opt = TRUE;
+            // printf("Argument to m is %s\n", optarg);
+            if (!convertNum(optarg, &mean, FLOAT, MEAN_MIN, MEAN_MAX)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'a':
+            a_opt = TRUE;
+            // printf("Argument to a is %s\n", optarg);
+            if (!convertNum(optarg, &amplitude, INTEGER, AMPLITUDE_MIN, AMPLITUDE_MAX)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            w_opt = TRUE;
+            
+            // Convert string to lowercase
+            for(i = 0; optarg[i]; i++) {
+                optarg[i] = tolower(optarg[i]);
+            }
+            
+            // Match option argument to waveform options
+            for (i=0; i<len_waveform; i++) {
+                if (strcmp(optarg, waveform_options[i]) == 0) {
+                    current_waveform = i;
+                    break;
+                }
+            }
+            
+            if (current_waveform == -1) {
+                printf("Undefined Waveform\n");
+                usage(argv[0]);
+            }
+            break;
+        case 's':
             // Not Implemented Yet
             s_opt = TRUE;
             printf("Argument to s is %s\n", optarg);
             break;
+        case 't':
+            wavetable_file = optarg;
+            break;
+        case 'g':
+            g_opt = TRUE;
+            break;
+        case 'p':
+            sample_path = optarg;
+            break;
+        case 'r':
+            if (!convertNum(optarg, &sample_rate, FLOAT, 1.0, 1000000.0)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            playback.loop = TRUE;
+            break;
+        case 'H':
+            partial_path = optarg;
+            break;
+        case 'M':
+            if (!parse_modulation(optarg)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'c':
+            if (!parse_sweep(optarg)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'S':
+            if (!convertNum(optarg, &seed, INTEGER, 0, 999999999)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'e':
+        case 'E':
+            if (!parse_envelope(optarg, opt == 'e')) {
+                usage(argv[0]);
+            }
+            break;
+        case 'T':
+            for (trigger.mode = 1; trigger.mode < 4 && strcmp(optarg, trigger_modes[trigger.mode]) != 0; trigger.mode++);
+            if (trigger.mode == 4) {
+                printf("Undefined trigger mode %s\n", optarg);
+                usage(argv[0]);
+            }
+            trigger.running = (trigger.mode == TRIGGER_STOP);
+            break;
+        case 'A':
+            if (!convertNum(optarg, &analysis_seconds, FLOAT, (float)ANALYSIS_MIN_POINTS / SAMPLE_RATE, 3600.0)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'x':
+            trace_file = optarg;
+            break;
+        case 'R':
+            record_path = optarg;
+            break;
+        case 'P':
+            replay_path = optarg;
+            break;
+        case 'O':
+            replay_output = optarg;
+            break;
+        case 'V':
+            replay_capture = optarg;
+            break;
+        case 'o':
+            tap_name = optarg;
+            break;
+        case 'I':
+            if (!convertNum(optarg, &host_count, INTEGER, 1, HOST_MAX_INSTANCES)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'Q':
+            if (!convertNum(optarg, &quality, INTEGER, QUALITY_FULL, NUM_QUALITY - 1)) {
+                usage(argv[0]);
+            }
+            watchdog.enabled = FALSE;
+            break;
+        case 'W':
+            watchdog_path = optarg;
+            break;
+        case 'U':
+            command_path = optarg;
+            break;
+        case 'F':
+            profile_file = optarg;
+            profiling = TRUE;
+            break;
+        case 'X':
+#ifdef SIMULATION
+            if (!parse_stress(optarg)) {
+                usage(argv[0]);
+            }
+#else
+            printf("Stress runs need a simulation build\n");
+            usage(argv[0]);
+#endif
+            break;
+        case 'j':
+            if (!convertNum(optarg, &host_threads, INTEGER, 1, HOST_MAX_WORKERS)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'C':
+            if (!convertNum(optarg, &bank_channels, INTEGER, 1, BANK_MAX_CHANNELS)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'B':
+            if (!convertNum(optarg, &max_boards, INTEGER, 1, MAX_BOARDS)) {
+                usage(argv[0]);
+            }
+            break;
         case '?':
             printf("Unknown option: %c\n", optopt);
             usage(argv[0]);
@@ -217,368 +1733,3246 @@ int main(int argc, char **argv)
             usage(argv[0]);
         }
     }
-    
-    // Prompt user for input
-    if (!f_opt) frequency = promptFloat("Input Frequency: ", FREQUENCY_MIN, FREQUENCY_MAX);
-    if (!m_opt) mean = promptFloat("Input Mean: ", MEAN_MIN, MEAN_MAX);
-    if (!a_opt) amplitude = promptInt("Input Amplitude: ", AMPLITUDE_MIN, AMPLITUDE_MAX);
-    if (!w_opt) {   
-        printf("Select Waveform: \n");
-        for (i=0; i<len_waveform; i++) {
-            printf("%d) %s\n", i, waveform_options[i]);
+    
+    // Build step: regenerate wavetable file and exit
+    if (g_opt) {
+        if (!build_wavetables(wavetable_file)) {
+            perror("build_wavetables");
+            exit(EXIT_FAILURE);
+        }
+        printf("Wavetables written to %s\n", wavetable_file);
+        return EXIT_SUCCESS;
+    }
+
+    // Map wavetables, generating the file on first run
+    if (!load_wavetables(wavetable_file)) {
+        if (!build_wavetables(wavetable_file) || !load_wavetables(wavetable_file)) {
+            perror("load_wavetables");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    // Map sample file for arbitrary waveform playback
+    if (sample_path != NULL) {
+        playback.rate = sample_rate;
+        if (!open_sample_file(sample_path)) {
+            perror("open_sample_file");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    seed_noise((uint32_t)seed);
+
+    // Build additive period table from partial list
+    if (partial_path != NULL && !load_partials(partial_path)) {
+        perror("load_partials");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Host mode: many headless generators on a worker pool
+    if (host_count > 0) {
+        run_host(host_count, host_threads);
+        return EXIT_SUCCESS;
+    }
+
+    // Channel bank benchmark: no hardware, parameters or prompts needed
+    if (bank_channels > 0) {
+        run_bank_benchmark(bank_channels);
+        return EXIT_SUCCESS;
+    }
+
+    // Replay: parameters come from the control file, render offline and exit
+    if (replay_path != NULL) {
+        return run_replay(replay_path, replay_output, replay_capture) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+#ifdef SIMULATION
+    // A stress run is headless, parameters not given start from a 10 Hz sine
+    if (stress.seconds > 0) {
+        if (!f_opt) frequency = 10.0;
+        if (!m_opt) mean = 1.0;
+        if (!a_opt) amplitude = 1000;
+        if (!w_opt) current_waveform = 0;
+        f_opt = m_opt = a_opt = w_opt = TRUE;
+    }
+#endif
+
+    // Prompt user for input
+    if (!f_opt) frequency = promptFloat("Input Frequency: ", FREQUENCY_MIN, FREQUENCY_MAX);
+    if (!m_opt) mean = promptFloat("Input Mean: ", MEAN_MIN, MEAN_MAX);
+    if (!a_opt) amplitude = promptInt("Input Amplitude: ", AMPLITUDE_MIN, AMPLITUDE_MAX);
+    if (!w_opt) {   
+        printf("Select Waveform: \n");
+        for (i=0; i<len_waveform; i++) {
+            printf("%d) %s\n", i, waveform_options[i]);
+        }
+       current_waveform = promptInt("Input: ", 0, len_waveform-1);
+    }
+
+    // Offline analysis: render without hardware, report quality and exit
+    if (analysis_seconds > 0) {
+        run_analysis(analysis_seconds);
+        return EXIT_SUCCESS;
+    }
+    
+    // PCI Setup
+	if(pci_attach(0)<0) {
+ 		 perror("pci_attach");
+ 		 exit(EXIT_FAILURE);
+ 	 }
+
+    // Every PCI-DAS1602 by index, board 0 also carries the sync marker and trigger line
+    for (num_boards = 0; num_boards < max_boards; num_boards++) {
+        memset(&info,0,sizeof(info));
+        info.VendorId=0x1307;
+        info.DeviceId=0x01;
+
+        if ((boards[num_boards].hdl=pci_attach_device(0, PCI_SHARE|PCI_INIT_ALL, num_boards, &info))==0) {
+            break;
+        }
+
+        for(i=0;i<5;i++) {
+            badr[i]=PCI_IO_ADDR(info.CpuBaseAddress[i]);
+        }
+
+        // Map I/O base address to user space
+        for(i=0;i<5;i++) {
+            boards[num_boards].iobase[i]=mmap_device_io(0x0f,badr[i]);
+        }
+    }
+    if (num_boards == 0) {
+        perror("pci_attach_device");
+        exit(EXIT_FAILURE);
+    }
+    iobase = boards[0].iobase;
+  	
+  	// Modify thread control privity
+	if(ThreadCtl(_NTO_TCTL_IO,0)==-1) {
+  		perror("Thread Control");
+ 		exit(EXIT_FAILURE);
+  	}
+
+    // DIO Setup: port A output for sync marker, port B input for trigger
+    if (sweep.sync || trigger.mode != TRIGGER_NONE) {
+        out8(DIO_CTLREG, 0x82);
+        out8(DIO_PORTA, 0);
+        trigger.level = in8(DIO_PORTB) & TRIGGER_LINE;
+    }
+
+    if (watchdog_path != NULL && (watchdog.log_fp = fopen(watchdog_path, "a")) == NULL) {
+        perror(watchdog_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (tap_name != NULL && !open_tap(tap_name)) {
+        perror(tap_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (record_path != NULL && !start_recording(record_path, (uint32_t)seed)) {
+        perror(record_path);
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef SIMULATION
+    // Stress run: the generator drives the simulated DAC while updater threads change the parameters
+    if (stress.seconds > 0) {
+        return run_stress((uint32_t)seed) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+#endif
+
+#ifdef __linux__
+    // Signals are read from a signalfd, so block them before any thread inherits the mask
+    sigemptyset(&control_signals);
+    sigaddset(&control_signals, SIGINT);
+    sigaddset(&control_signals, SIGTERM);
+    if (trace_file != NULL) sigaddset(&control_signals, SIGUSR2);
+    if (profile_file != NULL) sigaddset(&control_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &control_signals, NULL);
+    if (!open_control(&control, &control_signals, partial_path, command_path)) {
+        perror("open_control");
+        exit(EXIT_FAILURE);
+    }
+#else
+    // Trace dumps on request, written from the output thread so the handler only sets a flag
+    if (trace_file != NULL) {
+        memset(&trace_action, 0, sizeof(trace_action));
+        trace_action.sa_handler = request_trace_dump;
+        sigaction(SIGUSR2, &trace_action, NULL);
+    }
+    if (profile_file != NULL) {
+        memset(&trace_action, 0, sizeof(trace_action));
+        trace_action.sa_handler = request_profile_report;
+        sigaction(SIGUSR1, &trace_action, NULL);
+    }
+#endif
+    profile_start = trace_clock();
+
+    /* Curses Initialisations */
+    initscr();
+    raw();
+    keypad(stdscr, TRUE);
+    noecho();
+
+    pthread_create(&waveform_thread, NULL, waveform_generator, NULL);
+#ifdef SIMULATION
+    if (trigger.mode != TRIGGER_NONE) pthread_create(&sim_thread, NULL, sim_trigger_line, NULL);
+#endif
+    for (i = 1; i < num_boards; i++) {
+        pthread_create(&boards[i].thread, NULL, board_output, &boards[i]);
+    }
+
+#ifdef __linux__
+    // The main thread is the only control thread: keys, signals, display, partial reloads and commands
+    control_loop(&control);
+#else
+    pthread_create(&kb_thread, NULL, get_keyboard_input, NULL);
+
+    // Wait for shutdown condition
+    profile_register("main");
+    lock_mutex(&shutdown_mutex, LOCK_SHUTDOWN);
+    wait_condition(&shutdown_cond, &shutdown_mutex, LOCK_SHUTDOWN);
+    pthread_mutex_unlock(&shutdown_mutex);
+#endif
+
+    // Shutdown all threads, reading their CPU clocks first as they are gone afterwards
+    if (profile_file != NULL) profile_snapshot();
+    pthread_cancel(waveform_thread);
+#ifdef SIMULATION
+    if (trigger.mode != TRIGGER_NONE) pthread_cancel(sim_thread);
+#endif
+    for (i = 1; i < num_boards; i++) {
+        pthread_cancel(boards[i].thread);
+    }
+#ifdef __linux__
+    close_control(&control);
+#else
+    pthread_cancel(kb_thread);
+#endif
+
+    endwin();
+	
+	/*
+    out16(DA_CTLREG,(short)0x0a23);
+	out16(DA_FIFOCLR,(short) 0);
+	out16(DA_Data, 0x8fff);															
+  
+	out16(DA_CTLREG,(short)0x0a43);
+	out16(DA_FIFOCLR,(short) 0);
+	out16(DA_Data, 0x8fff);
+	*/
+																																						
+    for (i = 0; i < num_boards; i++) {
+        pci_detach_device(boards[i].hdl);
+    }
+    munmap(wavetable_map, wavetable_map_size);
+    free(wavetables);
+    free(wavetable_small_data);
+    if (playback.map != NULL) munmap((void*)playback.map, playback.map_size);
+    if (control_fp != NULL) fclose(control_fp);
+    if (tap != NULL) {
+        munmap(tap, sizeof(struct tap_header));
+        shm_unlink(tap_name);
+    }
+    if (watchdog.transitions > 0) {
+        printf("Quality watchdog: %ld transitions, ending at %s\n", watchdog.transitions, quality_names[quality]);
+        for (i = watchdog.transitions > WATCHDOG_LOG_SIZE ? watchdog.transitions - WATCHDOG_LOG_SIZE : 0;
+             i < watchdog.transitions; i++) {
+            printf("  %s\n", watchdog.log[i % WATCHDOG_LOG_SIZE]);
+        }
+    }
+    if (watchdog.log_fp != NULL) fclose(watchdog.log_fp);
+    if (trace_file != NULL && dump_trace(trace_file)) {
+        printf("Trace written to %s\n", trace_file);
+    }
+    if (num_boards > 1) print_board_timing();
+    if (profile_file != NULL) {
+        print_profile(stdout);
+        append_profile();
+    }
+    if (trigger.count > 0) {
+        printf("Trigger latency: %ld starts, mean %.1f us, max %.1f us\n",
+               trigger.count, trigger.total_ns / trigger.count / 1000.0, trigger.max_ns / 1000.0);
+    }
+    printf("Ending Program.\n");
+    return EXIT_SUCCESS;
+}
+
+void usage(char* progname) {
+    printf("Usage: %s [-f frequency] [-m mean] [-a amplitude] [-w waveform] [-s setting_file] [-t wavetable_file] [-g] [-p sample_file] [-r sample_rate] [-l] [-H partial_file] [-M modulation] [-c sweep] [-S seed] [-e adsr] [-E points] [-T trigger] [-A seconds] [-x trace_file] [-R control_file] [-P control_file] [-O output_file] [-V capture_file] [-B boards] [-o tap_name] [-C channels] [-I instances] [-j workers] [-Q quality] [-W log_file] [-U command_socket] [-F profile_file] [-X stress] [-h]\n", progname);
+	printf("[-s setting_file]: (file) Default setting for frequency, mean and amplitude. Overwritten when corresponding option is used during program call.\n");
+	printf("[-f frequency]: (float) Frequency of wave (Hz). Range: %f - %f\n", FREQUENCY_MIN, FREQUENCY_MAX);
+	printf("[-m mean]: (float) Prescaled mean of wave. Range: %f - %f\n", MEAN_MIN, MEAN_MAX);
+	printf("[-a amplitude]: (unsigned int) Amplitude of wave. Range: %d - %d\n", AMPLITUDE_MIN, AMPLITUDE_MAX);
+    printf("[-w waveform]: (string) Type of waveform. Options: sine, square, sawtooth, triangular, arbitrary, additive, chirp, white, pink, bandnoise.\n");
+    printf("[-t wavetable_file]: (file) Precomputed wavetable file, generated on first run if missing. Default: %s\n", WAVETABLE_FILE);
+    printf("[-g]: Regenerate the wavetable file and exit.\n");
+    printf("[-p sample_file]: (file) Raw samples for the arbitrary waveform. Signed 16-bit, or 32-bit float if named *.f32.\n");
+    printf("[-r sample_rate]: (float) Sample rate of sample_file (Hz), resampled to %d Hz on output. Default: %d\n", SAMPLE_RATE, SAMPLE_RATE);
+    printf("[-l]: Loop sample_file instead of stopping at its end.\n");
+    printf("[-H partial_file]: (file) Partials for the additive waveform, one \"harmonic amplitude phase\" per line. Max: %d\n", MAX_PARTIALS);
+    printf("[-M modulation]: (string) LFO modulation as target:waveform:frequency:depth, e.g. am:sine:0.5:0.3. Targets: am, fm, pm. LFO frequency at most %.2f Hz.\n", LFO_FREQUENCY_MAX);
+    printf("[-c sweep]: (string) Chirp as start:end:duration:law[:sync], e.g. 1:100:10:log:sync. Laws: lin, log. sync pulses DIO port A bit 0 at each sweep start.\n");
+    printf("[-S seed]: (int) Seed for the noise waveforms, for reproducible runs. Default: current time\n");
+    printf("[-e adsr]: (string) ADSR envelope as attack:decay:sustain:release, times in ms and sustain level 0 - 1. Press G to toggle the gate.\n");
+    printf("[-E points]: (string) Piecewise-linear envelope as ms:level,ms:level,...[/release_ms]. The last level is held while gated.\n");
+    printf("[-T trigger]: (string) DIO port B bit 0 controls output. start: rising edge starts, stop: each rising edge stops or restarts, gate: output while high.\n");
+    printf("[-A seconds]: (float) Render offline through each synthesis path and report THD, SNR, SFDR, frequency error and ns/sample, then exit.\n");
+    printf("[-x trace_file]: (file) Record timing events per thread, written on exit and on SIGUSR2. Convert with trace2json.\n");
+    printf("[-R control_file]: (file) Record every parameter change, trigger state change, DC hold and partial reload with the sample it took effect at.\n");
+    printf("[-P control_file]: (file) Replay a recording offline, without the board, and print a checksum of the output. Other options must match the recorded run.\n");
+    printf("[-O output_file]: (file) With -P, also write the replayed DAC codes as unsigned 16-bit samples.\n");
+    printf("[-V capture_file]: (file) With -P, compare the replayed codes sample by sample with the DAC writes captured from the recorded run by a simulation build with SIM_DAC_LOG set.\n");
+    printf("[-B boards]: (int) Most PCI-DAS1602 boards to drive in step, all found are used by default. Range: 1 - %d\n", MAX_BOARDS);
+    printf("[-o tap_name]: (string) Publish every block sent to the DAC in a shared-memory ring, e.g. %s. Follow it with tap_reader.\n", TAP_NAME);
+    printf("[-C channels]: (int) Benchmark a bank of independent channels, split across sine, square, sawtooth and triangular, and exit. Range: 1 - %d\n", BANK_MAX_CHANNELS);
+    printf("[-I instances]: (int) Host mode: run this many headless generators for %.0f s on a work-stealing worker pool, report per-instance render time and steals, and exit. Range: 1 - %d\n", HOST_SECONDS, HOST_MAX_INSTANCES);
+    printf("[-j workers]: (int) Worker threads in host mode. Default: online CPUs. Range: 1 - %d\n", HOST_MAX_WORKERS);
+    printf("[-Q quality]: (int) Fix the render quality and disable the watchdog. 0: full, 1: nearest table entry, 2: small tables, 3: low control rate.\n");
+    printf("[-W log_file]: (file) Append each watchdog quality transition, with the headroom that caused it.\n");
+    printf("[-U command_socket]: (file) Unix socket accepting one command per line: frequency <Hz>, mean <value>, amplitude <value>, waveform <name>, gate, status, quit. Linux only.\n");
+    printf("[-F profile_file]: (file) Profile CPU time, context switches and mutex waits per thread. The table is printed at exit and appended to profile_file at exit and on SIGUSR1.\n");
+    printf("[-X stress]: (string) Simulation builds: run the generator headless as seconds:updaters:rate:mode[:p99_us], e.g. 5:4:100:random, while each updater changes the parameters rate times a second (0: back to back). Modes: random, adversarial. Reports update-to-DAC latency, output glitches and mutex contention, and exits with status 1 on a glitch or a p99 latency over p99_us.\n");
+    printf("[-h]: Display this information..\n");
+    exit(EXIT_FAILURE);
+}
+
+bool input(char* var_pointer) {
+    /*
+    Prompts for keyboard inputs from user.
+    Stores input within a given address in string format.
+    
+    Parameters:
+        var_pointer: address to store user input in
+
+    Returns:
+        TRUE when input is sucessful, else FALSE
+    */
+    char value[MAX_INPUT] = "";
+    char c;
+
+    // Read input from stdin as string
+    fgets(value, MAX_INPUT, stdin);
+
+    // If last character in value is not \n, input buffer is not cleared.
+    if (!strchr(value, '\n')) {
+        printf("Exceed maximum input size\n\n");
+        
+        // Clear Input buffer
+        while ((c = getchar()) != '\n' && c != EOF);
+        return FALSE;
+    }
+
+    sscanf(value, "%s", var_pointer);
+    return TRUE;
+}
+
+bool convertNum(char* input, void* var_pointer, int format, float min, float max) {
+    /*
+    Converts input into desired format and stores value within a given address.
+    Accepts INTEGER or FLOAT format.
+
+    Parameters:
+        input: string to convert to number format
+        var_pointer: address to store converted input in
+        format: format for conversion of input
+        min: minimum value to accept
+        max: maximum value to accept
+
+    Returns:
+        TRUE when input is in correct format, else FALSE
+    */
+    if (format != INTEGER && format != FLOAT) {
+        printf("Unsupported format\n\n");
+        return FALSE;
+    }
+
+    switch (wg_parse_number(input, var_pointer, format, min, max)) {
+        case WG_OK:
+            return TRUE;
+        case WG_ERR_BELOW:
+            if (format == INTEGER) printf("%s is less than minimum number %d\n\n", input, (int) min);
+            else printf("%s is less than minimum number %f\n\n", input, min);
+            return FALSE;
+        case WG_ERR_ABOVE:
+            if (format == INTEGER) printf("%s is greater than maximum number %d\n\n", input, (int) max);
+            else printf("%s is greater than maximum number %f\n\n", input, max);
+            return FALSE;
+    }
+    printf("Invalid format. %s is not %s\n\n", input, format == INTEGER ? "integer" : "float");
+    return FALSE;
+}
+
+int promptInt(char* msg, int min, int max) {
+    /*
+    Prompts for int input from user.
+    Parameters:
+        msg: message to display to user during the prompt
+        min: minimum value to accept
+        max: maximum value to accept
+
+    Returns:
+        int input by user
+    */
+    int result;
+    char input_str[MAX_INPUT] = "";
+    while (TRUE) {
+        printf("%s", msg);
+        if (input(input_str)) {
+            // printf("%s\n", input_str);
+            if (convertNum(input_str, &result, INTEGER, min, max)) {
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+float promptFloat(char* msg, float min, float max) {
+    /*
+    Prompts for float input from user.
+    Parameters:
+        msg: message to display to user during the prompt
+        min: minimum value to accept
+        max: maximum value to accept
+
+    Returns:
+        float input by user
+    */
+    float result;
+    char input_str[MAX_INPUT] = "";
+    while (TRUE) {
+        printf("%s", msg);
+        if (input(input_str)) {
+            if (convertNum(input_str, &result, FLOAT, min, max)) {
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+void* get_keyboard_input() {
+    // Keyboard and display thread when there is no control loop, ncurses is only called from here
+    struct key_batch batch;
+
+    trace_register("keyboard");
+    profile_register("keyboard");
+    do {
+        // Fold everything typed since the last batch into one locked update, waiting at most one refresh
+        timeout(UI_REFRESH_US / 1000);
+        read_key_batch(&batch);
+        apply_key_batch(&batch);
+        update_output();
+        profile_sample();
+    } while (!batch.exit);
+
+    // Signal main thread to shutdown all threads and exit program
+    lock_mutex(&shutdown_mutex, LOCK_SHUTDOWN);
+    pthread_cond_signal(&shutdown_cond);
+    pthread_mutex_unlock(&shutdown_mutex);
+    pthread_exit(NULL);
+}
+
+void read_key_batch(struct key_batch* batch) {
+    /*
+    Blocks for one key, then drains whatever else is already queued without blocking
+    and folds it all into net steps per parameter. Keys after 'E' are ignored.
+
+    Parameters:
+        batch: net change of the keys read
+    */
+    int ch, count = 0;
+
+    memset(batch, 0, sizeof(*batch));
+    ch = getch();
+    nodelay(stdscr, TRUE);
+    while (ch != ERR) {
+        switch(ch) {
+            case KEY_UP:
+                batch->amplitude += key_steps(ch);
+                break;
+            case KEY_DOWN:
+                batch->amplitude -= key_steps(ch);
+                break;
+            case KEY_RIGHT:
+                batch->frequency += key_steps(ch);
+                break;
+            case KEY_LEFT:
+                batch->frequency -= key_steps(ch);
+                break;
+            case 'w':
+            case 'W':
+                batch->mean += key_steps(ch);
+                break;
+            case 's':
+            case 'S':
+                batch->mean -= key_steps(ch);
+                break;
+            case 'a':
+            case 'A':
+                batch->waveform -= 1;
+                break;
+            case 'd':
+            case 'D':
+                batch->waveform += 1;
+                break;
+            case 'g':
+            case 'G':
+                batch->gate = !batch->gate;
+                break;
+            case 'E':
+                batch->exit = TRUE;
+                break;
+        }
+        if (batch->exit || ++count == KEY_BATCH_MAX) break;
+        ch = getch();
+    }
+    nodelay(stdscr, FALSE);
+}
+
+void apply_key_batch(const struct key_batch* batch) {
+    // Publishes the net change of a batch as one parameter update, constraining only what changed
+    if (batch->amplitude == 0 && batch->frequency == 0 && batch->mean == 0 && batch->waveform == 0 && !batch->gate) {
+        return;
+    }
+
+    lock_globals();
+    if (batch->amplitude != 0) {
+        amplitude += batch->amplitude * AMPLITUDE_STEP_SIZE;
+        constrain(&amplitude, AMPLITUDE_MIN, AMPLITUDE_MAX, INTEGER);
+    }
+    if (batch->frequency != 0) {
+        frequency += batch->frequency * FREQUENCY_STEP_SIZE;
+        constrain(&frequency, FREQUENCY_MIN, FREQUENCY_MAX, FLOAT);
+    }
+    if (batch->mean != 0) {
+        mean += batch->mean * MEAN_STEP_SIZE;
+        constrain(&mean, MEAN_MIN, MEAN_MAX, FLOAT);
+    }
+    if (batch->waveform != 0) {
+        current_waveform += batch->waveform;
+        constrain(&current_waveform, 0, len_waveform-1, INTEGER);
+    }
+    if (batch->gate) envelope.gate = !envelope.gate;
+    notify_param_change();
+    pthread_mutex_unlock(&global_mutex);
+}
+
+int key_steps(int ch) {
+    /*
+    Steps one press of ch is worth. Auto-repeat of a held key arrives as the same key in quick
+    succession, so the step size doubles every KEY_ACCEL_INTERVAL_NS the key has been held.
+
+    Parameters:
+        ch: key read
+
+    Returns:
+        number of steps, at least 1
+    */
+    static int held_key = ERR;
+    static uint64_t held_since, last_seen;
+    uint64_t now = trace_clock(), shift;
+
+    if (ch != held_key || now - last_seen > KEY_REPEAT_GAP_NS) {
+        held_key = ch;
+        held_since = now;
+    }
+    last_seen = now;
+
+    shift = (now - held_since) / KEY_ACCEL_INTERVAL_NS;
+    if (shift > KEY_ACCEL_MAX_SHIFT) shift = KEY_ACCEL_MAX_SHIFT;
+    return 1 << shift;
+}
+
+void constrain(void* var_pointer, float min, float max, int format) {
+    if (format != INTEGER && format != FLOAT) {
+        printf("Unsupported format\n\n");
+        return;
+    }
+    wg_constrain(var_pointer, format, min, max);
+}
+
+void sine(double* out, const double* phase, int n) {
+    const float* table = active_table(0);
+    int k;
+    for (k = 0; k < n; k++) {
+        out[k] = read_table(table, phase[k]);
+    }
+}
+
+void square(double* out, const double* phase, int n) {
+    const float* table = bandlimited_table(WT_SQUARE_BL, frequency, SAMPLE_RATE);
+    int k;
+    for (k = 0; k < n; k++) {
+        out[k] = read_table(table, phase[k]);
+    }
+}
+
+void sawtooth(double* out, const double* phase, int n) {
+    const float* table = bandlimited_table(WT_SAWTOOTH_BL, frequency, SAMPLE_RATE);
+    int k;
+    for (k = 0; k < n; k++) {
+        out[k] = read_table(table, phase[k]);
+    }
+}
+
+void triangular(double* out, const double* phase, int n) {
+    const float* table = active_table(3);
+    int k;
+    for (k = 0; k < n; k++) {
+        out[k] = read_table(table, phase[k]);
+    }
+}
+
+void arbitrary(double* out, const double* phase, int n) {
+    /*
+    Streams the mapped sample file, linearly interpolating to SAMPLE_RATE.
+    Pages ahead of playback are advised for read-ahead and pages behind are dropped,
+    so files larger than memory play without being loaded.
+    */
+    double step = playback.rate / SAMPLE_RATE;
+    double frac;
+    size_t index, next, window;
+    int k;
+
+    (void)phase;                                    // Playback keeps its own position in the file
+    for (k = 0; k < n; k++) {
+        if (playback.position >= playback.num_samples) {
+            if (playback.loop && playback.num_samples > 0) {
+                playback.position = fmod(playback.position, (double)playback.num_samples);
+            }
+            else {
+                out[k] = 0.0;
+                continue;
+            }
+        }
+        index = (size_t)playback.position;
+        frac = playback.position - index;
+        out[k] = read_sample(index);
+        if (frac > 0.0) {
+            next = index + 1 < playback.num_samples ? index + 1 : (playback.loop ? 0 : index);
+            out[k] += frac * (read_sample(next) - out[k]);
+        }
+        playback.position += step;
+    }
+
+    if (playback.map == NULL) return;
+
+    // Move the read-ahead window once playback crosses into a new window
+    window = (size_t)playback.position * (playback.format == SAMPLE_FORMAT_FLOAT ? sizeof(float) : sizeof(int16_t)) / PLAYBACK_WINDOW;
+    if (window != playback.advised_window) {
+#ifdef MADV_WILLNEED
+        if ((window + 1) * PLAYBACK_WINDOW < playback.map_size) {
+            madvise((char*)playback.map + (window + 1) * PLAYBACK_WINDOW,
+                    (window + 2) * PLAYBACK_WINDOW < playback.map_size ? PLAYBACK_WINDOW : playback.map_size - (window + 1) * PLAYBACK_WINDOW,
+                    MADV_WILLNEED);
+        }
+#endif
+#ifdef MADV_DONTNEED
+        if (window > playback.advised_window) {
+            madvise((char*)playback.map + playback.advised_window * PLAYBACK_WINDOW,
+                    (window - playback.advised_window) * PLAYBACK_WINDOW, MADV_DONTNEED);
+        }
+#endif
+        playback.advised_window = window;
+    }
+}
+
+bool parse_modulation(char* spec) {
+    /*
+    Parses a modulation routing of the form target:waveform:frequency:depth.
+    Any phase driven waveform can be the LFO, arbitrary, chirp and noise are rejected as they carry their own state.
+    The LFO is sampled once per block, or once per CONTROL_DIVIDER blocks under load, so its frequency is
+    limited to LFO_FREQUENCY_MAX.
+
+    Parameters:
+        spec: modulation routing string
+
+    Returns:
+        TRUE when spec is valid, else FALSE
+    */
+    char* fields[4];
+    int k;
+
+    for (k = 0; k < 4; k++) {
+        fields[k] = strtok(k == 0 ? spec : NULL, ":");
+        if (fields[k] == NULL) {
+            printf("Modulation requires target:waveform:frequency:depth\n");
+            return FALSE;
+        }
+    }
+
+    for (k = 0; k < 4 && strcmp(fields[0], modulation_targets[k]) != 0; k++);
+    if (k == 4) {
+        printf("Undefined modulation target %s\n", fields[0]);
+        return FALSE;
+    }
+    modulation.target = k;
+
+    for (k = 0; k < len_waveform && strcmp(fields[1], waveform_options[k]) != 0; k++);
+    if (k == len_waveform || !phase_driven(k)) {
+        printf("Undefined LFO waveform %s\n", fields[1]);
+        return FALSE;
+    }
+    modulation.waveform = k;
+
+    if (!convertNum(fields[2], &modulation.frequency, FLOAT, 0.0, LFO_FREQUENCY_MAX)) return FALSE;
+    if (!convertNum(fields[3], &modulation.depth, FLOAT, 0.0, 1.0)) return FALSE;
+    return TRUE;
+}
+
+double lfo_value(double phase, double rate) {
+    /*
+    Evaluates the LFO waveform at phase.
+    Square and sawtooth are read from the level band-limited for the LFO's own frequency at the rate it is
+    evaluated at, as their waveform functions pick the level from the carrier frequency.
+
+    Parameters:
+        phase: LFO phase in cycles [0, 1)
+        rate: LFO evaluations per second
+
+    Returns:
+        LFO output
+    */
+    double value;
+
+    if (waveformArray[modulation.waveform] == square) {
+        return read_table(bandlimited_table(WT_SQUARE_BL, modulation.frequency, rate), phase);
+    }
+    if (waveformArray[modulation.waveform] == sawtooth) {
+        return read_table(bandlimited_table(WT_SAWTOOTH_BL, modulation.frequency, rate), phase);
+    }
+    waveformArray[modulation.waveform](&value, &phase, 1);
+    return value;
+}
+
+bool parse_sweep(char* spec) {
+    /*
+    Parses a chirp of the form start:end:duration:law[:sync].
+
+    Parameters:
+        spec: sweep string
+
+    Returns:
+        TRUE when spec is valid, else FALSE
+    */
+    char* fields[5];
+    int k;
+
+    for (k = 0; k < 5; k++) {
+        fields[k] = strtok(k == 0 ? spec : NULL, ":");
+        if (fields[k] == NULL && k < 4) {
+            printf("Sweep requires start:end:duration:law[:sync]\n");
+            return FALSE;
+        }
+    }
+
+    if (!convertNum(fields[0], &sweep.start, FLOAT, FREQUENCY_MIN, SAMPLE_RATE / 2.0)) return FALSE;
+    if (!convertNum(fields[1], &sweep.end, FLOAT, FREQUENCY_MIN, SAMPLE_RATE / 2.0)) return FALSE;
+    if (!convertNum(fields[2], &sweep.duration, FLOAT, 1.0 / SAMPLE_RATE, 86400.0)) return FALSE;
+
+    for (k = 0; k < 2 && strcmp(fields[3], sweep_laws[k]) != 0; k++);
+    if (k == 2) {
+        printf("Undefined sweep law %s\n", fields[3]);
+        return FALSE;
+    }
+    sweep.law = k;
+    if (sweep.law == SWEEP_LOG && (sweep.start <= 0 || sweep.end <= 0)) {
+        printf("Logarithmic sweep requires non-zero frequencies\n");
+        return FALSE;
+    }
+
+    sweep.sync = (fields[4] != NULL && strcmp(fields[4], "sync") == 0);
+    return TRUE;
+}
+
+void start_sweep() {
+    // Resets the sweep to its start frequency, keeping phase so repeats join without a step
+    long length = (long)(sweep.duration * SAMPLE_RATE);
+    if (length < 1) length = 1;
+
+    sweep.inc = sweep.start / SAMPLE_RATE;
+    if (sweep.law == SWEEP_LOG) {
+        sweep.inc_step = pow(sweep.end / sweep.start, 1.0 / length);
+    }
+    else {
+        sweep.inc_step = (sweep.end - sweep.start) / SAMPLE_RATE / length;
+    }
+    sweep.remaining = length;
+}
+
+void chirp(double* out, const double* phase, int n) {
+    /*
+    Sine sweep between sweep.start and sweep.end, restarting at the end of each sweep.
+    Phase is integrated incrementally so the sweep stays continuous.
+    phase holds depth * lfo per sample rather than a phase: under FM it scales the sweep increment,
+    under PM it offsets the sweep phase in cycles.
+    */
+    const float* table = active_table(0);
+    double value;
+    int k;
+
+    for (k = 0; k < n; k++) {
+        if (sweep.remaining == 0) {
+            start_sweep();
+            if (sweep.sync_sample == -1) sweep.sync_sample = k;
+        }
+        value = modulation.target == MOD_PM ? sweep.phase + phase[k] : sweep.phase;
+        out[k] = read_table(table, value - floor(value));
+        sweep.phase += modulation.target == MOD_FM ? sweep.inc * (1.0 + phase[k]) : sweep.inc;
+        if (sweep.phase >= 1.0) sweep.phase -= 1.0;
+        if (sweep.law == SWEEP_LOG) {
+            sweep.inc *= sweep.inc_step;
+        }
+        else {
+            sweep.inc += sweep.inc_step;
+        }
+        sweep.remaining--;
+    }
+}
+
+void seed_noise(uint32_t seed) {
+    // Seeds every xoshiro128+ lane from one value with splitmix32, so runs with the same seed repeat exactly
+    int l, w;
+    uint32_t z;
+
+    memset(&noise, 0, sizeof(noise));
+    for (l = 0; l < NOISE_LANES; l++) {
+        for (w = 0; w < 4; w++) {
+            z = (seed += 0x9e3779b9);
+            z = (z ^ (z >> 16)) * 0x85ebca6b;
+            z = (z ^ (z >> 13)) * 0xc2b2ae35;
+            noise.s[w][l] = z ^ (z >> 16);
+        }
+    }
+}
+
+void noise_fill(double* out, int n) {
+    /*
+    Fills out with n uniform white noise samples in [-1, 1).
+    NOISE_LANES xoshiro128+ generators are stepped together so the loop vectorises.
+
+    Parameters:
+        out: buffer to fill
+        n: number of samples, at most 2 * BLOCK_SIZE
+    */
+    static double lanes[2 * BLOCK_SIZE + NOISE_LANES];
+    uint32_t t;
+    int k, l;
+
+    for (k = 0; k < n; k += NOISE_LANES) {
+        for (l = 0; l < NOISE_LANES; l++) {
+            lanes[k + l] = (int32_t)(noise.s[0][l] + noise.s[3][l]) * (1.0 / 2147483648.0);
+            t = noise.s[1][l] << 9;
+            noise.s[2][l] ^= noise.s[0][l];
+            noise.s[3][l] ^= noise.s[1][l];
+            noise.s[1][l] ^= noise.s[2][l];
+            noise.s[0][l] ^= noise.s[3][l];
+            noise.s[2][l] ^= t;
+            noise.s[3][l] = (noise.s[3][l] << 11) | (noise.s[3][l] >> 21);
+        }
+    }
+    memcpy(out, lanes, n * sizeof(double));
+}
+
+void white(double* out, const double* phase, int n) {
+    (void)phase;
+    noise_fill(out, n);
+}
+
+void pink(double* out, const double* phase, int n) {
+    /*
+    Voss-McCartney pink noise. Each sample replaces the row given by the trailing zeros of a counter,
+    so row r changes every 2^r samples and the running sum is updated with one subtraction and one addition.
+    */
+    double uniform[2 * BLOCK_SIZE];
+    int k, row;
+
+    (void)phase;
+    noise_fill(uniform, 2 * n);
+    for (k = 0; k < n; k++) {
+        noise.pink_counter++;
+        row = __builtin_ctz(noise.pink_counter);
+        if (row < PINK_ROWS) {
+            noise.pink_sum += uniform[2 * k] - noise.pink_rows[row];
+            noise.pink_rows[row] = uniform[2 * k];
+        }
+        out[k] = (noise.pink_sum + uniform[2 * k + 1]) / (PINK_ROWS + 1);
+    }
+}
+
+void bandnoise(double* out, const double* phase, int n) {
+    // White noise through a constant peak gain band-pass biquad centred on frequency
+    double w0, alpha, y;
+    int k;
+
+    (void)phase;
+    if (noise.band_frequency != frequency) {
+        noise.band_frequency = frequency;
+        w0 = 2 * M_PI * frequency / SAMPLE_RATE;
+        alpha = sin(w0) / (2 * NOISE_BAND_Q);
+        noise.b0 = alpha / (1 + alpha);
+        noise.a1 = -2 * cos(w0) / (1 + alpha);
+        noise.a2 = (1 - alpha) / (1 + alpha);
+    }
+
+    noise_fill(out, n);
+    for (k = 0; k < n; k++) {
+        y = noise.b0 * (out[k] - noise.x2) - noise.a1 * noise.y1 - noise.a2 * noise.y2;
+        noise.x2 = noise.x1;
+        noise.x1 = out[k];
+        noise.y2 = noise.y1;
+        noise.y1 = y;
+        out[k] = y;
+    }
+}
+
+bool parse_envelope(char* spec, bool adsr) {
+    /*
+    Parses an envelope into a list of points reached in turn while the gate is on.
+    ADSR is attack:decay:sustain:release, piecewise-linear is ms:level,ms:level,...[/release_ms].
+
+    Parameters:
+        spec: envelope string
+        adsr: TRUE to parse spec as ADSR, else as piecewise-linear points
+
+    Returns:
+        TRUE when spec is valid, else FALSE
+    */
+    float attack, decay, sustain, release = 0.0, ms, level;
+    char* release_str;
+    char* point;
+
+    if (adsr) {
+        if (sscanf(spec, "%f:%f:%f:%f", &attack, &decay, &sustain, &release) != 4 ||
+            attack < 0 || decay < 0 || release < 0 || sustain < 0 || sustain > 1) {
+            printf("ADSR envelope requires attack:decay:sustain:release\n");
+            return FALSE;
+        }
+        envelope.num_points = 2;
+        envelope.duration[0] = (int)(attack * SAMPLE_RATE / 1000);
+        envelope.level[0] = 1.0;
+        envelope.duration[1] = (int)(decay * SAMPLE_RATE / 1000);
+        envelope.level[1] = sustain;
+    }
+    else {
+        if ((release_str = strchr(spec, '/')) != NULL) {
+            *release_str++ = '\0';
+            if (sscanf(release_str, "%f", &release) != 1 || release < 0) {
+                printf("Invalid envelope release %s\n", release_str);
+                return FALSE;
+            }
+        }
+        envelope.num_points = 0;
+        for (point = strtok(spec, ","); point != NULL; point = strtok(NULL, ",")) {
+            if (envelope.num_points == MAX_ENVELOPE_POINTS || sscanf(point, "%f:%f", &ms, &level) != 2 || ms < 0) {
+                printf("Invalid envelope point %s\n", point);
+                return FALSE;
+            }
+            envelope.duration[envelope.num_points] = (int)(ms * SAMPLE_RATE / 1000);
+            envelope.level[envelope.num_points++] = level;
+        }
+        if (envelope.num_points == 0) {
+            printf("Envelope requires at least one point\n");
+            return FALSE;
+        }
+    }
+
+    envelope.release = (int)(release * SAMPLE_RATE / 1000);
+    envelope.enabled = TRUE;
+    return TRUE;
+}
+
+void start_segment(int stage) {
+    // Starts a linear segment from the current gain, so retriggering mid-segment does not step
+    double target = 0.0;
+
+    envelope.stage = stage;
+    if (stage == ENV_RELEASE) {
+        envelope.remaining = envelope.release;
+    }
+    else if (stage >= 0 && stage < envelope.num_points) {
+        envelope.remaining = envelope.duration[stage];
+        target = envelope.level[stage];
+    }
+    else {
+        envelope.remaining = 0;
+        return;
+    }
+
+    if (envelope.remaining == 0) {
+        envelope.gain = target;
+        envelope.step = 0.0;
+    }
+    else {
+        envelope.step = (target - envelope.gain) / envelope.remaining;
+    }
+}
+
+void apply_envelope(double* shape, int n) {
+    /*
+    Multiplies a block by the envelope gain, stepping the gain by a fixed increment per sample.
+    Held stages (sustain and idle) cost one multiply per sample and no state updates.
+    */
+    int k = 0, m;
+
+    if (envelope.gate != envelope.gated) {
+        envelope.gated = envelope.gate;
+        start_segment(envelope.gate ? 0 : ENV_RELEASE);
+    }
+
+    while (k < n) {
+        if (envelope.remaining == 0) {
+            // Segment finished, land exactly on its level then move on or hold
+            if (envelope.stage >= 0 && envelope.stage < envelope.num_points) {
+                envelope.gain = envelope.level[envelope.stage];
+                start_segment(envelope.stage + 1);
+                continue;
+            }
+            if (envelope.stage == ENV_RELEASE) {
+                envelope.gain = 0.0;
+                envelope.stage = ENV_IDLE;
+            }
+            for (; k < n; k++) shape[k] *= envelope.gain;
+            break;
+        }
+
+        m = envelope.remaining < n - k ? envelope.remaining : n - k;
+        envelope.remaining -= m;
+        for (; m > 0; m--, k++) {
+            shape[k] *= envelope.gain;
+            envelope.gain += envelope.step;
+        }
+    }
+}
+
+void additive(double* out, const double* phase, int n) {
+    // Same reads as read_table(), the partial sum is kept in double precision
+    const double* table = quality >= QUALITY_SMALL_TABLES ? additive_small : additive_table;
+    int size = active_table_size(), k, i;
+    double x;
+
+    for (k = 0; k < n; k++) {
+        x = phase[k] * size;
+        i = (int)x;
+        out[k] = quality == QUALITY_FULL ? table[i] + (x - i) * (table[(i + 1) & (size - 1)] - table[i]) : table[i];
+    }
+}
+
+void add_partials(double* table, const struct partial* list, int count) {
+    /*
+    Adds one period of the sum of partials to table using a bank of recurrence oscillators.
+    Each oscillator steps as s[n+1] = 2cos(w)s[n] - s[n-1], so sin() is only called to seed it.
+    Oscillators are stepped PARTIAL_LANES at a time so the inner loop vectorises.
+
+    Parameters:
+        table: period table of WAVETABLE_SIZE samples to accumulate into
+        list: partials to add, negative amplitudes subtract a partial
+        count: number of partials in list
+    */
+    double coef[PARTIAL_LANES], s1[PARTIAL_LANES], s2[PARTIAL_LANES], amp[PARTIAL_LANES], acc[PARTIAL_LANES];
+    double w, s0, sum;
+    int p, l, n;
+
+    for (p = 0; p < count; p += PARTIAL_LANES) {
+        // Seed the next group of oscillators, padding unused lanes with silent ones
+        for (l = 0; l < PARTIAL_LANES; l++) {
+            if (p + l < count) {
+                w = 2 * M_PI * list[p + l].harmonic / WAVETABLE_SIZE;
+                coef[l] = 2 * cos(w);
+                s1[l] = sin(list[p + l].phase);
+                s2[l] = sin(list[p + l].phase - w);
+                amp[l] = list[p + l].amplitude;
+            }
+            else {
+                coef[l] = s1[l] = s2[l] = amp[l] = 0.0;
+            }
+        }
+
+        for (n = 0; n < WAVETABLE_SIZE; n++) {
+            for (l = 0; l < PARTIAL_LANES; l++) {
+                acc[l] = amp[l] * s1[l];
+                s0 = coef[l] * s1[l] - s2[l];
+                s2[l] = s1[l];
+                s1[l] = s0;
+            }
+            sum = 0.0;
+            for (l = 0; l < PARTIAL_LANES; l++) sum += acc[l];
+            table[n] += sum;
+        }
+    }
+}
+
+bool load_partials(char* path) {
+    /*
+    Reads a partial list and applies it to the additive period table with apply_partials().
+
+    Parameters:
+        path: text file with one "harmonic amplitude phase" partial per line, # starts a comment
+
+    Returns:
+        TRUE when the file is read successfully, else FALSE
+    */
+    static struct partial new_partials[MAX_PARTIALS];
+    struct partial p;
+    char line[256];
+    int num_new = 0;
+    FILE* fp;
+
+    if ((fp = fopen(path, "r")) == NULL) return FALSE;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#') continue;
+        p.phase = 0.0;
+        if (sscanf(line, "%d %lf %lf", &p.harmonic, &p.amplitude, &p.phase) < 2) continue;
+        if (p.harmonic < 1 || p.harmonic >= WAVETABLE_SIZE / 2) {
+            printf("Harmonic %d out of range\n", p.harmonic);
+            continue;
+        }
+        if (num_new == MAX_PARTIALS) {
+            printf("Too many partials, ignoring after %d\n", MAX_PARTIALS);
+            break;
+        }
+        new_partials[num_new++] = p;
+    }
+    fclose(fp);
+
+    apply_partials(new_partials, num_new);
+    return TRUE;
+}
+
+void apply_partials(const struct partial* new_partials, int num_new) {
+    /*
+    Updates the additive period table to a new partial list incrementally.
+    Only partials that differ from the current list are rendered: the old partial is subtracted and the new one added.
+    Every PARTIAL_REBUILD_INTERVAL reloads the table is rebuilt from the whole list instead, so rounding
+    in the running sum cannot build up. The delta is built outside global_mutex and merged under it.
+    A recording gets the whole list, so its replay goes through the same updates and rounds the same way.
+
+    Parameters:
+        new_partials: partial list to switch to
+        num_new: number of partials in new_partials
+    */
+    static struct partial delta[2 * MAX_PARTIALS];
+    static double delta_table[WAVETABLE_SIZE];
+    static int reloads = 0;
+    int num_delta = 0, k;
+    bool rebuild;
+
+    // Collect changed partials as a subtract/add pair, or the whole list when rebuilding
+    rebuild = (++reloads % PARTIAL_REBUILD_INTERVAL == 0);
+    if (rebuild) {
+        memcpy(delta, new_partials, num_new * sizeof(struct partial));
+        num_delta = num_new;
+    }
+    for (k = 0; !rebuild && (k < num_new || k < num_partials); k++) {
+        if (k < num_new && k < num_partials && same_partial(&new_partials[k], &partials[k])) continue;
+        if (k < num_partials) {
+            delta[num_delta] = partials[k];
+            delta[num_delta++].amplitude = -partials[k].amplitude;
+        }
+        if (k < num_new) delta[num_delta++] = new_partials[k];
+    }
+
+    memset(delta_table, 0, sizeof(delta_table));
+    add_partials(delta_table, delta, num_delta);
+
+    lock_globals();
+    for (k = 0; k < WAVETABLE_SIZE; k++) additive_table[k] = rebuild ? delta_table[k] : additive_table[k] + delta_table[k];
+    for (k = 0; k < SMALL_TABLE_SIZE; k++) additive_small[k] = additive_table[k * SMALL_TABLE_DECIMATION];
+    memcpy(partials, new_partials, num_new * sizeof(struct partial));
+    num_partials = num_new;
+    if (control_fp != NULL) record_partials(new_partials, num_new);
+    notify_param_change();
+    pthread_mutex_unlock(&global_mutex);
+}
+
+bool same_partial(const struct partial* a, const struct partial* b) {
+    // Field by field, struct partial has padding after harmonic
+    return a->harmonic == b->harmonic && a->amplitude == b->amplitude && a->phase == b->phase;
+}
+
+double read_sample(size_t index) {
+    // Returns a sample of the mapped file normalised to [-1, 1]
+    if (playback.format == SAMPLE_FORMAT_FLOAT) {
+        return ((const float*)playback.map)[index];
+    }
+    return ((const int16_t*)playback.map)[index] / 32768.0;
+}
+
+bool open_sample_file(char* path) {
+    /*
+    Maps a raw sample file read-only for the arbitrary waveform.
+    The format is 32-bit float if the name ends in .f32, else signed 16-bit.
+
+    Parameters:
+        path: sample file to map
+
+    Returns:
+        TRUE when the file is mapped successfully, else FALSE
+    */
+    struct stat st;
+    char* ext;
+    void* map;
+    int fd;
+
+    ext = strrchr(path, '.');
+    playback.format = (ext != NULL && strcmp(ext, ".f32") == 0) ? SAMPLE_FORMAT_FLOAT : SAMPLE_FORMAT_INT16;
+
+    if ((fd = open(path, O_RDONLY)) == -1) return FALSE;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return FALSE;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return FALSE;
+
+    playback.map = map;
+    playback.map_size = st.st_size;
+    playback.num_samples = st.st_size / (playback.format == SAMPLE_FORMAT_FLOAT ? sizeof(float) : sizeof(int16_t));
+    playback.position = 0.0;
+    playback.advised_window = 0;
+
+    // Playback is sequential, so let the kernel read ahead aggressively
+#ifdef MADV_SEQUENTIAL
+    madvise(map, playback.map_size, MADV_SEQUENTIAL);
+#endif
+    return TRUE;
+}
+
+const float* bandlimited_table(int first_level, double freq, double rate) {
+    /*
+    Selects the band-limited octave table for a frequency played at a sample rate.
+    Level k keeps harmonics up to 2^k, so the richest level whose top harmonic stays below Nyquist is used.
+
+    Parameters:
+        first_level: index of level 0 of the waveform in wavetable[]
+        freq: fundamental frequency in Hz
+        rate: sample rate the table is read at in Hz
+
+    Returns:
+        table to read the waveform from
+    */
+    int level = wg_bandlimited_level(freq, rate);
+
+    if (quality >= QUALITY_SMALL_TABLES && level > SMALL_TABLE_MAX_LEVEL) level = SMALL_TABLE_MAX_LEVEL;
+    return active_table(first_level + level);
+}
+
+bool build_wavetables(char* path) {
+    /*
+    Computes every table with the engine library and writes them to a wavetable file.
+    The file is written under a temporary name and renamed into place, so concurrent instances never map a partial file.
+
+    Parameters:
+        path: wavetable file to create or replace
+
+    Returns:
+        TRUE when the file is written successfully, else FALSE
+    */
+    void* memory;
+    bool written;
+
+    if ((memory = malloc(wg_tables_size())) == NULL) return FALSE;
+    written = wg_tables_write(wg_tables_init(memory, wg_tables_size()), path) == WG_OK;
+    free(memory);
+    return written;
+}
+
+bool load_wavetables(char* path) {
+    /*
+    Maps a wavetable file read-only and points wavetables and wavetable[] at its tables.
+    The mapping is shared, so every generator instance and every host engine reads the same pages from the page cache.
+
+    Parameters:
+        path: wavetable file to map
+
+    Returns:
+        TRUE when the file exists and matches the current format, else FALSE
+    */
+    struct stat st;
+    int fd, t, k;
+
+    if (wavetables == NULL && (wavetables = malloc(wg_tables_map_size())) == NULL) return FALSE;
+    if ((fd = open(path, O_RDONLY)) == -1) return FALSE;
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(struct wg_file_header)) {
+        close(fd);
+        return FALSE;
+    }
+
+    wavetable_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (wavetable_map == MAP_FAILED) return FALSE;
+    wavetable_map_size = st.st_size;
+
+    // Reject files from other versions so they are regenerated
+    if (wg_tables_map(wavetables, wg_tables_map_size(), wavetable_map, wavetable_map_size) == NULL) {
+        munmap(wavetable_map, wavetable_map_size);
+        wavetable_map = MAP_FAILED;
+        return FALSE;
+    }
+    for (t = 0; t < WT_NUM_TABLES; t++) {
+        wavetable[t] = wg_table(wavetables, t);
+    }
+
+    // Decimated copies for the watchdog's small-table step, built once so switching costs nothing
+    free(wavetable_small_data);
+    wavetable_small_data = malloc(WT_NUM_TABLES * SMALL_TABLE_SIZE * sizeof(float));
+    if (wavetable_small_data == NULL) return FALSE;
+    for (t = 0; t < WT_NUM_TABLES; t++) {
+        for (k = 0; k < SMALL_TABLE_SIZE; k++) {
+            wavetable_small_data[t * SMALL_TABLE_SIZE + k] = wavetable[t][k * SMALL_TABLE_DECIMATION];
+        }
+        wavetable_small[t] = wavetable_small_data + t * SMALL_TABLE_SIZE;
+    }
+    return TRUE;
+}
+
+void update_output() {
+    // Serves pending trace and profile dump requests and redraws the screen, called at up to 10 Hz
+    if (trace_dump_requested) {
+        trace_dump_requested = 0;
+        dump_trace(trace_file);
+    }
+    if (profile_report_requested) {
+        profile_report_requested = 0;
+        append_profile();
+    }
+    draw_screen();
+}
+
+void draw_screen() {
+    float samples[SCOPE_SIZE];
+    uint64_t draw_start;
+
+    draw_start = trace_clock();
+    clear();
+    printw("Press E to Exit\n\n");
+    printw("Up/Down: Change Amplitude\n");
+    printw("Left/Right: Change Frequency\n");
+    printw("W/S: Change Mean\n");
+    printw("A/D: Change Waveform\n");
+    printw("G: Toggle Envelope Gate\n");
+    lock_globals();
+    printw("\nFrequency: %f",frequency);
+    printw("\nMean: %f",mean);
+    printw("\nAmplitude: %d",amplitude);
+    printw("\nWaveform: %s",waveform_options[current_waveform]);
+    if (trigger.mode != TRIGGER_NONE) {
+        printw("\nTrigger: %s, %s, last latency %.1f us",
+               trigger_modes[trigger.mode], trigger.running ? "running" : "armed", trigger.last_ns / 1000.0);
+    }
+    if (num_boards > 1) printw("\nBoards: %d", num_boards);
+    printw("\nQuality: %s%s, headroom min %.0f%% mean %.0f%%", quality_names[quality],
+           watchdog.enabled ? "" : " (fixed)", watchdog.last_min * 100, watchdog.last_mean * 100);
+    pthread_mutex_unlock(&global_mutex);
+
+    if (read_snapshot(samples)) {
+        draw_scope(samples);
+        draw_spectrum(samples);
+    }
+    trace_span(TRACE_UI_REFRESH, draw_start);
+    refresh();
+}
+
+#ifdef __linux__
+bool open_control(struct control* ctl, const sigset_t* signals, char* partial_path, char* command_path) {
+    /*
+    Creates every descriptor the control loop waits on and registers it with one epoll instance.
+    Called before curses starts so failures can still be reported on the terminal.
+
+    Parameters:
+        ctl: control state to fill in
+        signals: signals already blocked in every thread, delivered through a signalfd
+        partial_path: partial file to reload when it is rewritten, NULL for none
+        command_path: Unix socket to accept commands on, NULL for none
+
+    Returns:
+        TRUE when all sources are ready, else FALSE with errno set
+    */
+    struct epoll_event event;
+    struct itimerspec period;
+    struct sockaddr_un addr;
+    char dir[CONTROL_PATH_SIZE];
+    int k;
+
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->signal_fd = ctl->timer_fd = ctl->inotify_fd = ctl->listen_fd = -1;
+    for (k = 0; k < COMMAND_MAX_CLIENTS; k++) ctl->clients[k].fd = -1;
+    ctl->partial_path = partial_path;
+    ctl->command_path = command_path;
+
+    if ((ctl->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) return FALSE;
+    event.events = EPOLLIN;
+    event.data.fd = STDIN_FILENO;
+    if (epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == -1) return FALSE;
+
+    if ((ctl->signal_fd = signalfd(-1, signals, SFD_CLOEXEC)) == -1) return FALSE;
+    event.data.fd = ctl->signal_fd;
+    if (epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, ctl->signal_fd, &event) == -1) return FALSE;
+
+    if ((ctl->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1) return FALSE;
+    period.it_interval.tv_sec = 0;
+    period.it_interval.tv_nsec = UI_REFRESH_US * 1000;
+    period.it_value = period.it_interval;
+    if (timerfd_settime(ctl->timer_fd, 0, &period, NULL) == -1) return FALSE;
+    event.data.fd = ctl->timer_fd;
+    if (epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, ctl->timer_fd, &event) == -1) return FALSE;
+
+    // Watch the directory rather than the file, editors replace files by renaming over them
+    if (partial_path != NULL) {
+        if (strlen(partial_path) >= sizeof(dir)) {
+            errno = ENAMETOOLONG;
+            return FALSE;
+        }
+        strcpy(dir, partial_path);
+        ctl->partial_name = strrchr(partial_path, '/');
+        if (ctl->partial_name == NULL) {
+            ctl->partial_name = partial_path;
+            strcpy(dir, ".");
+        }
+        else {
+            dir[ctl->partial_name - partial_path] = '\0';
+            if (dir[0] == '\0') strcpy(dir, "/");
+            ctl->partial_name++;
+        }
+        if ((ctl->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) return FALSE;
+        if (inotify_add_watch(ctl->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) return FALSE;
+        event.data.fd = ctl->inotify_fd;
+        if (epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, ctl->inotify_fd, &event) == -1) return FALSE;
+    }
+
+    if (command_path != NULL) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(command_path) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return FALSE;
+        }
+        strcpy(addr.sun_path, command_path);
+        unlink(command_path);
+        if ((ctl->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) return FALSE;
+        if (bind(ctl->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) return FALSE;
+        if (listen(ctl->listen_fd, COMMAND_MAX_CLIENTS) == -1) return FALSE;
+        event.data.fd = ctl->listen_fd;
+        if (epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, ctl->listen_fd, &event) == -1) return FALSE;
+    }
+    return TRUE;
+}
+
+void control_loop(struct control* ctl) {
+    /*
+    Single control thread: sleeps in epoll_wait() until a key, signal, refresh tick, change to the
+    partial file or command arrives, and returns when the program should exit.
+
+    Parameters:
+        ctl: sources from open_control()
+    */
+    struct epoll_event events[CONTROL_MAX_EVENTS], client;
+    struct signalfd_siginfo info;
+    struct key_batch batch;
+    struct inotify_event* change;
+    char changes[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint64_t ticks;
+    ssize_t len;
+    int n, k, j, fd;
+    bool running = TRUE, reload;
+
+    trace_register("control");
+    profile_register("control");
+    while (running) {
+        if ((n = epoll_wait(ctl->epoll_fd, events, CONTROL_MAX_EVENTS, -1)) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (k = 0; k < n; k++) {
+            fd = events[k].data.fd;
+            if (fd == STDIN_FILENO) {
+                read_key_batch(&batch);
+                apply_key_batch(&batch);
+                if (batch.exit) running = FALSE;
+            }
+            else if (fd == ctl->signal_fd) {
+                while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo == SIGUSR2) dump_trace(trace_file);
+                    else if (info.ssi_signo == SIGUSR1) append_profile();
+                    else running = FALSE;
+                    break;
+                }
+            }
+            else if (fd == ctl->timer_fd) {
+                if (read(fd, &ticks, sizeof(ticks)) == sizeof(ticks)) draw_screen();
+            }
+            else if (fd == ctl->inotify_fd) {
+                // Coalesce every event for the partial file in this read into one reload
+                reload = FALSE;
+                while ((len = read(fd, changes, sizeof(changes))) > 0) {
+                    for (j = 0; j < len; j += sizeof(struct inotify_event) + change->len) {
+                        change = (struct inotify_event*)(changes + j);
+                        if (change->len > 0 && strcmp(change->name, ctl->partial_name) == 0) reload = TRUE;
+                    }
+                }
+                if (reload) load_partials(ctl->partial_path);
+            }
+            else if (fd == ctl->listen_fd) {
+                if ((fd = accept(fd, NULL, NULL)) == -1) continue;
+                for (j = 0; j < COMMAND_MAX_CLIENTS && ctl->clients[j].fd != -1; j++);
+                if (j == COMMAND_MAX_CLIENTS) {
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                ctl->clients[j].fd = fd;
+                ctl->clients[j].used = 0;
+                client.events = EPOLLIN;
+                client.data.fd = fd;
+                epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, fd, &client);
+            }
+            else {
+                for (j = 0; j < COMMAND_MAX_CLIENTS && ctl->clients[j].fd != fd; j++);
+                if (j == COMMAND_MAX_CLIENTS) continue;
+                if (!read_command(&ctl->clients[j])) running = FALSE;
+            }
+        }
+        profile_sample();
+    }
+}
+
+bool read_command(struct command_client* client) {
+    /*
+    Reads what a client sent, runs each complete line and writes one reply line per command.
+    The connection is closed on EOF, on error and when a line does not fit in the buffer.
+
+    Parameters:
+        client: connection that became readable
+
+    Returns:
+        FALSE when a quit command was received, else TRUE
+    */
+    char reply[COMMAND_LINE_SIZE];
+    char* end;
+    ssize_t len;
+    int line_len;
+    bool running = TRUE;
+
+    while ((len = read(client->fd, client->line + client->used, COMMAND_LINE_SIZE - 1 - client->used)) > 0) {
+        client->used += len;
+        client->line[client->used] = '\0';
+        while ((end = strchr(client->line, '\n')) != NULL) {
+            *end = '\0';
+            line_len = end - client->line + 1;
+            if (!run_command(client->line, reply, sizeof(reply))) running = FALSE;
+            if (write(client->fd, reply, strlen(reply)) < 0) break;
+            client->used -= line_len;
+            memmove(client->line, client->line + line_len, client->used + 1);
+        }
+        if (client->used == COMMAND_LINE_SIZE - 1) break;
+    }
+    if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && client->used < COMMAND_LINE_SIZE - 1) {
+        return running;
+    }
+
+    // Closing the descriptor also removes it from the epoll set
+    close(client->fd);
+    client->fd = -1;
+    return running;
+}
+
+bool run_command(char* line, char* reply, size_t size) {
+    /*
+    Applies one text command under global_mutex, the same way a key batch is applied.
+
+    Parameters:
+        line: command without its newline
+        reply: filled with "ok", an error or the status line, newline-terminated
+        size: size of reply
+
+    Returns:
+        FALSE for quit, else TRUE
+    */
+    char name[COMMAND_LINE_SIZE], arg[COMMAND_LINE_SIZE], c;
+    float value, min, max;
+    int fields, k, format, int_value;
+
+    fields = sscanf(line, "%127s %127s %c", name, arg, &c);
+    snprintf(reply, size, "ok\n");
+    if (fields < 1) {
+        snprintf(reply, size, "error: empty command\n");
+        return TRUE;
+    }
+    if (strcmp(name, "quit") == 0) return FALSE;
+
+    if (fields == 1 && strcmp(name, "status") == 0) {
+        lock_globals();
+        snprintf(reply, size, "frequency %f mean %f amplitude %u waveform %s quality %s\n",
+                 frequency, mean, amplitude, waveform_options[current_waveform], quality_names[quality]);
+        pthread_mutex_unlock(&global_mutex);
+        return TRUE;
+    }
+    if (fields == 1 && strcmp(name, "gate") == 0) {
+        lock_globals();
+        envelope.gate = !envelope.gate;
+        notify_param_change();
+        pthread_mutex_unlock(&global_mutex);
+        return TRUE;
+    }
+    if (fields != 2) {
+        snprintf(reply, size, "error: unknown command %s\n", line);
+        return TRUE;
+    }
+
+    if (strcmp(name, "waveform") == 0) {
+        for (k = 0; k < len_waveform && strcmp(arg, waveform_options[k]) != 0; k++);
+        if (k == len_waveform) {
+            snprintf(reply, size, "error: undefined waveform %s\n", arg);
+            return TRUE;
+        }
+        lock_globals();
+        current_waveform = k;
+        notify_param_change();
+        pthread_mutex_unlock(&global_mutex);
+        return TRUE;
+    }
+
+    // Numbers go through the shared parser, so formats and ranges match the command line
+    if (strcmp(name, "frequency") == 0) {
+        format = FLOAT; min = FREQUENCY_MIN; max = FREQUENCY_MAX;
+    }
+    else if (strcmp(name, "mean") == 0) {
+        format = FLOAT; min = MEAN_MIN; max = MEAN_MAX;
+    }
+    else if (strcmp(name, "amplitude") == 0) {
+        format = INTEGER; min = AMPLITUDE_MIN; max = AMPLITUDE_MAX;
+    }
+    else {
+        snprintf(reply, size, "error: unknown command %s\n", line);
+        return TRUE;
+    }
+    switch (wg_parse_number(arg, format == INTEGER ? (void*)&int_value : (void*)&value, format, min, max)) {
+        case WG_OK:
+            break;
+        case WG_ERR_BELOW:
+            snprintf(reply, size, "error: %s is less than minimum %g\n", arg, min);
+            return TRUE;
+        case WG_ERR_ABOVE:
+            snprintf(reply, size, "error: %s is greater than maximum %g\n", arg, max);
+            return TRUE;
+        default:
+            snprintf(reply, size, "error: %s is not %s\n", arg, format == INTEGER ? "an integer" : "a number");
+            return TRUE;
+    }
+
+    lock_globals();
+    if (strcmp(name, "frequency") == 0) frequency = value;
+    else if (strcmp(name, "mean") == 0) mean = value;
+    else amplitude = (unsigned int)int_value;
+    notify_param_change();
+    pthread_mutex_unlock(&global_mutex);
+    return TRUE;
+}
+
+void close_control(struct control* ctl) {
+    int k;
+
+    for (k = 0; k < COMMAND_MAX_CLIENTS; k++) {
+        if (ctl->clients[k].fd != -1) close(ctl->clients[k].fd);
+    }
+    if (ctl->listen_fd != -1) {
+        close(ctl->listen_fd);
+        unlink(ctl->command_path);
+    }
+    if (ctl->inotify_fd != -1) close(ctl->inotify_fd);
+    close(ctl->timer_fd);
+    close(ctl->signal_fd);
+    close(ctl->epoll_fd);
+}
+#endif
+
+void run_analysis(float seconds) {
+    /*
+    Renders the current settings offline through every synthesis path and prints quality figures for each.
+    Paths are the general render_block(), the specialised kernel, and for sine the precise sin() reference.
+
+    Parameters:
+        seconds: length to render, the analysis uses the largest power of two of samples that fits
+    */
+    unsigned int block[BLOCK_SIZE];
+    struct render_plan plan;
+    struct timespec start, end;
+    double* x;
+    double phase;
+    int n = ANALYSIS_MIN_POINTS, total = (int)(seconds * SAMPLE_RATE), k, j;
+
+    while (n * 2 <= total) n *= 2;
+    if ((x = malloc(n * sizeof(double))) == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    printf("%s, %f Hz, mean %f, amplitude %d, %d point FFT at %d Hz\n",
+           waveform_options[current_waveform], frequency, mean, amplitude, n, SAMPLE_RATE);
+    printf("%-8s %10s %14s %10s %10s %10s\n", "path", "ns/sample", "freq err (Hz)", "THD (dB)", "SNR (dB)", "SFDR (dB)");
+
+    phase = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (k = 0; k < n; k += BLOCK_SIZE) {
+        phase = render_block(block, BLOCK_SIZE, phase);
+        for (j = 0; j < BLOCK_SIZE && k + j < n; j++) x[k + j] = block[j];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    analyse_signal("block", x, n, ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / n);
+
+    plan.version = param_version - 1;
+    select_kernel(&plan, FORMAT_CODE, 1);
+    if (plan.kernel != NULL) {
+        phase = 0.0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (k = 0; k < n; k += BLOCK_SIZE) {
+            phase = plan.kernel(block, BLOCK_SIZE, phase, &plan);
+            for (j = 0; j < BLOCK_SIZE && k + j < n; j++) x[k + j] = block[j];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        analyse_signal("kernel", x, n, ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / n);
+    }
+
+    if (waveformArray[current_waveform] == sine) {
+        // Unquantised double precision sin(), the quality ceiling for the other paths
+        phase = 0.0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (k = 0; k < n; k++) {
+            x[k] = (sin(2 * M_PI * phase) + mean) * amplitude;
+            phase += frequency / SAMPLE_RATE;
+            if (phase >= 1.0) phase -= 1.0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        analyse_signal("sin()", x, n, ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / n);
+    }
+    free(x);
+}
+
+void analyse_signal(char* path_name, double* x, int n, double ns_per_sample) {
+    /*
+    Prints THD, SNR, SFDR and frequency error of a rendered signal from a Blackman-Harris windowed FFT.
+    The fundamental is the strongest bin near frequency, refined by parabolic interpolation.
+    Harmonics above Nyquist are folded back to where they alias.
+
+    Parameters:
+        path_name: label for the report row
+        x: n samples, overwritten
+        n: number of samples, a power of two
+        ns_per_sample: render time to report alongside
+    */
+    double* im = calloc(n, sizeof(double));
+    double* power = malloc((n / 2 + 1) * sizeof(double));
+    char* used = calloc(n / 2 + 1, 1);
+    double bin_width = (double)SAMPLE_RATE / n, mean_x = 0.0, w;
+    double fund_power = 0.0, harm_power = 0.0, noise_power = 0.0, spur = 0.0;
+    double a, b, c, delta, measured, f;
+    int k, peak, lo, hi, h, bin, centre;
+
+    if (im == NULL || power == NULL || used == NULL) {
+        perror("analyse_signal");
+        free(im); free(power); free(used);
+        return;
+    }
+
+    for (k = 0; k < n; k++) mean_x += x[k];
+    mean_x /= n;
+    for (k = 0; k < n; k++) {
+        w = 0.35875 - 0.48829 * cos(2 * M_PI * k / n) + 0.14128 * cos(4 * M_PI * k / n) - 0.01168 * cos(6 * M_PI * k / n);
+        x[k] = (x[k] - mean_x) * w;
+    }
+    fft(x, im, n);
+    for (k = 0; k <= n / 2; k++) power[k] = x[k] * x[k] + im[k] * im[k];
+
+    // DC leakage is not part of the signal
+    for (k = 0; k <= ANALYSIS_LOBE; k++) used[k] = 1;
+
+    // Fundamental
+    lo = ANALYSIS_LOBE + 1;
+    hi = n / 2 - 1;
+    if (frequency > 0) {
+        centre = (int)(frequency / bin_width + 0.5);
+        if (centre - 5 > lo) lo = centre - 5;
+        if (centre + 5 < hi) hi = centre + 5;
+    }
+    for (peak = lo, k = lo; k <= hi; k++) {
+        if (power[k] > power[peak]) peak = k;
+    }
+    a = log(power[peak - 1] + 1e-300);
+    b = log(power[peak] + 1e-300);
+    c = log(power[peak + 1] + 1e-300);
+    delta = (a - 2 * b + c) != 0 ? 0.5 * (a - c) / (a - 2 * b + c) : 0.0;
+    measured = (peak + delta) * bin_width;
+    for (k = peak - ANALYSIS_LOBE; k <= peak + ANALYSIS_LOBE; k++) {
+        if (k > 0 && k <= n / 2 && !used[k]) {
+            fund_power += power[k];
+            used[k] = 1;
+        }
+    }
+
+    // Harmonics, folded about Nyquist
+    for (h = 2; h <= ANALYSIS_HARMONICS; h++) {
+        f = fmod(h * measured, (double)SAMPLE_RATE);
+        if (f > SAMPLE_RATE / 2.0) f = SAMPLE_RATE - f;
+        centre = (int)(f / bin_width + 0.5);
+        for (bin = centre, k = centre - 2; k <= centre + 2; k++) {
+            if (k > 0 && k <= n / 2 && power[k] > power[bin]) bin = k;
+        }
+        for (k = bin - ANALYSIS_LOBE; k <= bin + ANALYSIS_LOBE; k++) {
+            if (k > 0 && k <= n / 2 && !used[k]) {
+                harm_power += power[k];
+                used[k] = 2;
+            }
+        }
+    }
+
+    // Everything else is noise, the largest bin outside the fundamental is the worst spur
+    for (k = 1; k <= n / 2; k++) {
+        if (used[k] != 1 && power[k] > spur) spur = power[k];
+        if (!used[k]) noise_power += power[k];
+    }
+
+    if (fund_power <= 0) {
+        printf("%-8s %10.2f %14s\n", path_name, ns_per_sample, "no signal");
+        free(im);
+        free(power);
+        free(used);
+        return;
+    }
+    printf("%-8s %10.2f %14.6f %10.2f %10.2f %10.2f\n", path_name, ns_per_sample,
+           frequency > 0 ? measured - frequency : 0.0,
+           10 * log10((harm_power + 1e-300) / fund_power),
+           10 * log10(fund_power / (noise_power + 1e-300)),
+           10 * log10(power[peak] / (spur + 1e-300)));
+
+    free(im);
+    free(power);
+    free(used);
+}
+
+bool start_recording(char* path, uint32_t seed) {
+    /*
+    Opens path for recording and writes the control header.
+    The generator appends a record whenever it picks up new parameters.
+
+    Parameters:
+        path: control file to create
+        seed: noise seed to store, so a replay reproduces the noise waveforms
+
+    Returns:
+        TRUE when recording started, else FALSE
+    */
+    struct control_header header = {CONTROL_MAGIC, CONTROL_VERSION, seed, SAMPLE_RATE};
+
+    if ((control_fp = fopen(path, "wb")) == NULL) return FALSE;
+    if (fwrite(&header, sizeof(header), 1, control_fp) != 1) {
+        fclose(control_fp);
+        control_fp = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void record_control(uint64_t sample, uint32_t flags) {
+    /*
+    Appends the current parameters and render quality, caller must hold global_mutex.
+
+    Parameters:
+        sample: first output sample written with them
+        flags: CONTROL_* state the generator enters at sample, 0 for blocks rendered from there on
+    */
+    struct control_record record;
+
+    memset(&record, 0, sizeof(record));
+    record.sample = sample;
+    record.frequency = frequency;
+    record.mean = mean;
+    record.amplitude = amplitude;
+    record.waveform = current_waveform;
+    record.gate = envelope.gate;
+    record.quality = quality;
+    record.flags = flags;
+    fwrite(&record, sizeof(record), 1, control_fp);
+}
+void record_partials(const struct partial* list, int count) {
+    // Appends a reloaded partial list, which takes effect with the next record, caller must hold global_mutex
+    struct control_record record;
+
+    memset(&record, 0, sizeof(record));
+    record.sample = sample_clock;
+    record.flags = CONTROL_PARTIALS;
+    record.count = count;
+    fwrite(&record, sizeof(record), 1, control_fp);
+    fwrite(list, sizeof(struct partial), count, control_fp);
+}
+
+bool run_replay(char* path, char* output_path, char* capture_path) {
+    /*
+    Renders a recorded run offline, entering each recorded state at the sample it was recorded at.
+    Blocks are rendered whole from each record and cut at the next one, as the generator cuts them when it
+    stops or holds, holds and armed periods repeat their level, and reloaded partial lists go through the
+    same table updates, so the codes are those the first board was written with, sample for sample.
+    Prints render time and an FNV-1a checksum of the DAC codes for comparing builds.
+
+    Parameters:
+        path: control file written with -R
+        output_path: file for the DAC codes, or NULL
+        capture_path: SIM_DAC_LOG capture of the recorded run to compare the codes with, or NULL
+
+    Returns:
+        TRUE when the whole recording was replayed and matched any capture, else FALSE
+    */
+    struct control_header header;
+    struct control_record** records;
+    struct control_record* record;
+    struct capture_entry* capture = NULL;
+    struct render_plan plan;
+    struct timespec start, end;
+    struct stat st;
+    unsigned int block[BLOCK_SIZE];
+    uint16_t code, expected = 0;
+    uint64_t sample = 0, total = 0, segment_end, hash = 14695981039346656037ULL;
+    double phase = 0.0, elapsed_ns = 0.0;
+    size_t size, pos, num_records = 0, num_capture = 0, next_capture = 0, i, j;
+    long compared = 0, mismatches = 0;
+    char* data;
+    FILE* fp;
+    FILE* out = NULL;
+    int n, k;
+
+    if ((fp = fopen(path, "rb")) == NULL || fstat(fileno(fp), &st) != 0) {
+        perror(path);
+        if (fp != NULL) fclose(fp);
+        return FALSE;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != CONTROL_MAGIC ||
+        header.version != CONTROL_VERSION || header.sample_rate != SAMPLE_RATE) {
+        printf("%s is not a control recording for %d Hz output\n", path, SAMPLE_RATE);
+        fclose(fp);
+        return FALSE;
+    }
+    size = st.st_size - sizeof(header);
+    data = malloc(size);
+    records = malloc((size / sizeof(struct control_record) + 1) * sizeof(struct control_record*));
+    if (data == NULL || records == NULL || fread(data, 1, size, fp) != size) {
+        printf("Cannot read %s\n", path);
+        free(data);
+        free(records);
+        fclose(fp);
+        return FALSE;
+    }
+    fclose(fp);
+
+    // Index the records, a partial list is stored right after its record
+    for (pos = 0; pos + sizeof(struct control_record) <= size; pos += sizeof(struct control_record)) {
+        record = (struct control_record*)(data + pos);
+        if (record->flags & CONTROL_PARTIALS) {
+            if (record->count > MAX_PARTIALS || pos + sizeof(struct control_record) + record->count * sizeof(struct partial) > size) break;
+            pos += record->count * sizeof(struct partial);
+        }
+        records[num_records++] = record;
+    }
+    if (num_records == 0) {
+        printf("%s has no parameter records\n", path);
+        free(data);
+        free(records);
+        return FALSE;
+    }
+    if (output_path != NULL && (out = fopen(output_path, "wb")) == NULL) {
+        perror(output_path);
+        free(data);
+        free(records);
+        return FALSE;
+    }
+    if (capture_path != NULL && (capture = read_capture(capture_path, &num_capture)) == NULL) {
+        if (out != NULL) fclose(out);
+        free(data);
+        free(records);
+        return FALSE;
+    }
+
+    seed_noise(header.seed);
+    plan.version = param_version - 1;
+
+    for (i = 0; i < num_records; i++) {
+        record = records[i];
+        if (record->flags & CONTROL_PARTIALS) {
+            apply_partials((const struct partial*)(record + 1), record->count);
+            continue;
+        }
+
+        // Enter the recorded state, clamped as the keyboard thread would
+        frequency = record->frequency;
+        mean = record->mean;
+        amplitude = record->amplitude;
+        current_waveform = record->waveform;
+        envelope.gate = record->gate;
+        quality = record->quality < NUM_QUALITY ? record->quality : QUALITY_FULL;
+        constrain(&frequency, FREQUENCY_MIN, FREQUENCY_MAX, FLOAT);
+        constrain(&mean, MEAN_MIN, MEAN_MAX, FLOAT);
+        constrain(&amplitude, AMPLITUDE_MIN, AMPLITUDE_MAX, INTEGER);
+        constrain(&current_waveform, 0, len_waveform-1, INTEGER);
+        param_version++;
+
+        for (j = i + 1; j < num_records && (records[j]->flags & CONTROL_PARTIALS); j++);
+        segment_end = j < num_records ? records[j]->sample : record->sample + REPLAY_TAIL;
+        if (record->flags & CONTROL_START) phase = 0.0;
+        if (record->flags & CONTROL_HOLD) {
+            // The generator renders one sample, keeps its phase and holds the code
+            render_block(block, 1, phase);
+            for (k = 1; k < BLOCK_SIZE; k++) block[k] = block[0];
+        }
+        if (record->flags & CONTROL_ARMED) {
+            for (k = 0; k < BLOCK_SIZE; k++) block[k] = (unsigned int)(mean * amplitude);
+        }
+
+        for (sample = record->sample; sample < segment_end; sample += n) {
+            n = segment_end - sample < BLOCK_SIZE ? segment_end - sample : BLOCK_SIZE;
+            if (!(record->flags & (CONTROL_HOLD | CONTROL_ARMED))) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if (plan.version != param_version) select_kernel(&plan, FORMAT_CODE, 1);
+                if (plan.kernel != NULL) {
+                    phase = plan.kernel(block, BLOCK_SIZE, phase, &plan);
+                }
+                else {
+                    phase = render_block(block, BLOCK_SIZE, phase);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                elapsed_ns += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+            }
+
+            for (k = 0; k < n; k++) {
+                code = (uint16_t)block[k];
+                hash = (hash ^ (code & 0xff)) * 1099511628211ULL;
+                hash = (hash ^ (code >> 8)) * 1099511628211ULL;
+                if (out != NULL) fwrite(&code, sizeof(code), 1, out);
+
+                // The DAC keeps the last code written at or before this sample
+                while (next_capture < num_capture && capture[next_capture].sample <= sample + k) {
+                    expected = (uint16_t)capture[next_capture++].code;
+                }
+                if (next_capture == 0 || sample + k > capture[num_capture - 1].sample) continue;
+                compared++;
+                if (code != expected && mismatches++ == 0) {
+                    printf("First mismatch at sample %llu: replayed %u, captured %u\n",
+                           (unsigned long long)(sample + k), code, expected);
+                }
+            }
+            total += n;
+        }
+    }
+
+    printf("Replayed %zu records over %llu samples, %.2f ns/sample, checksum %016llx\n",
+           num_records, (unsigned long long)total, total > 0 ? elapsed_ns / total : 0.0, (unsigned long long)hash);
+    if (capture != NULL) printf("Compared %ld samples with %s: %ld differ\n", compared, capture_path, mismatches);
+    free(data);
+    free(records);
+    free(capture);
+    if (out != NULL && fclose(out) != 0) {
+        perror(output_path);
+        return FALSE;
+    }
+    return capture == NULL || (compared > 0 && mismatches == 0);
+}
+struct capture_entry* read_capture(char* path, size_t* count) {
+    /*
+    Reads a DAC capture written by the simulated backend.
+
+    Parameters:
+        path: file named by SIM_DAC_LOG in the recorded run
+        count: set to the number of writes read
+
+    Returns:
+        writes in the order they happened, to be freed by the caller, or NULL on error
+    */
+    struct capture_entry* capture;
+    struct stat st;
+    FILE* fp;
+
+    if ((fp = fopen(path, "rb")) == NULL || fstat(fileno(fp), &st) != 0) {
+        perror(path);
+        if (fp != NULL) fclose(fp);
+        return NULL;
+    }
+    *count = st.st_size / sizeof(struct capture_entry);
+    if (*count == 0 || (capture = malloc(*count * sizeof(struct capture_entry))) == NULL) {
+        printf("%s has no DAC writes\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    *count = fread(capture, sizeof(struct capture_entry), *count, fp);
+    fclose(fp);
+    return capture;
+}
+
+int bank_add_channel(struct channel_bank* bank, int waveform, float freq, float offset, float gain) {
+    /*
+    Adds a channel to the group of its waveform.
+
+    Parameters:
+        bank: channel bank
+        waveform: index into waveform_options, below BANK_WAVEFORMS
+        freq: frequency (Hz)
+        offset, gain: DAC code = shape * gain + offset
+
+    Returns:
+        position of the channel within an output frame, or -1 if the bank is full
+    */
+    struct channel_group* group;
+    int w, position = 0;
+
+    if (waveform < 0 || waveform >= BANK_WAVEFORMS || bank->group[waveform].count == BANK_MAX_CHANNELS) return -1;
+    group = &bank->group[waveform];
+    group->phase[group->count] = 0.0;
+    group->phase_inc[group->count] = freq / SAMPLE_RATE;
+    group->gain[group->count] = gain;
+    group->offset[group->count] = offset;
+    group->count++;
+    bank->count++;
+
+    for (w = 0; w < waveform; w++) position += bank->group[w].count;
+    return position + group->count - 1;
+}
+
+void render_bank(struct channel_bank* bank, float* out, int n) {
+    /*
+    Renders n frames of every channel, frames laid out channel after channel in waveform group order.
+    Each group is one pass over its channels per sample, free of branches and float compares
+    (which block if-conversion under trapping math) so the compiler vectorizes it.
+    Shapes are computed rather than read from the wavetables, since a table read per lane is a gather
+    most SIMD targets do not have. Sine is a folded odd polynomial, error below 4e-6.
+
+    Parameters:
+        bank: channel bank, phases are advanced
+        out: n * bank->count DAC codes
+        n: number of frames
+    */
+    struct channel_group* g;
+    float* frame;
+    float p, x, y, y2;
+    int w, s, c, base = 0, count;
+
+    for (w = 0; w < BANK_WAVEFORMS; w++) {
+        g = &bank->group[w];
+        count = g->count;
+        for (s = 0; s < n; s++) {
+            frame = out + s * bank->count + base;
+            switch (w) {
+                case 0:
+                    for (c = 0; c < count; c++) {
+                        p = g->phase[c] + g->phase_inc[c];
+                        p -= (float)(int)p;
+                        g->phase[c] = p;
+                        // Quarter-wave fold: x - 0.5 runs through 0, 1, 0, -1 as a triangle and sin(2 pi p) = sin(pi/2 tri)
+                        x = p + 0.25f;
+                        x -= (float)(int)x;
+                        y = (float)M_PI_2 * (1.0f - 4.0f * fabsf(x - 0.5f));
+                        y2 = y * y;
+                        y = y * (1.0f + y2 * (-1.0f / 6 + y2 * (1.0f / 120 + y2 * (-1.0f / 5040 + y2 * (1.0f / 362880)))));
+                        frame[c] = g->offset[c] + y * g->gain[c];
+                    }
+                    break;
+                case 1:
+                    for (c = 0; c < count; c++) {
+                        p = g->phase[c] + g->phase_inc[c];
+                        p -= (float)(int)p;
+                        g->phase[c] = p;
+                        // Low for the first half period, as the square table is
+                        frame[c] = g->offset[c] + (2.0f * (float)(int)(2.0f * p) - 1.0f) * g->gain[c];
+                    }
+                    break;
+                case 2:
+                    for (c = 0; c < count; c++) {
+                        p = g->phase[c] + g->phase_inc[c];
+                        p -= (float)(int)p;
+                        g->phase[c] = p;
+                        frame[c] = g->offset[c] + (2.0f * p - 1.0f) * g->gain[c];
+                    }
+                    break;
+                case 3:
+                    for (c = 0; c < count; c++) {
+                        p = g->phase[c] + g->phase_inc[c];
+                        p -= (float)(int)p;
+                        g->phase[c] = p;
+                        // Same quarter-wave shift as sine, so it starts at 0 and rises like the triangular table
+                        x = p + 0.25f;
+                        x -= (float)(int)x;
+                        frame[c] = g->offset[c] + (1.0f - 4.0f * fabsf(x - 0.5f)) * g->gain[c];
+                    }
+                    break;
+            }
+        }
+        base += count;
+    }
+}
+
+void run_bank_benchmark(int channels) {
+    /*
+    Renders a bank of channels for BANK_BENCH_SECONDS and prints throughput per waveform group and overall.
+    Channels cycle through the bank waveforms, with frequencies spread over the whole range.
+    Build with -O3 and the target's SIMD flags (e.g. -march=native) to use its full vector width.
+
+    Parameters:
+        channels: number of channels in the bank
+    */
+    static struct channel_bank bank;
+    static struct channel_bank single;
+    struct timespec start, end;
+    float* out;
+    double elapsed, group_time[BANK_WAVEFORMS], max_error = 0.0;
+    long blocks, total_blocks = 0;
+    int c, w;
+
+    memset(&bank, 0, sizeof(bank));
+    for (c = 0; c < channels; c++) {
+        bank_add_channel(&bank, c % BANK_WAVEFORMS, FREQUENCY_MAX * (c + 1) / (channels + 1), 2.0 * 1000, 1000);
+    }
+    if ((out = malloc(BLOCK_SIZE * BANK_MAX_CHANNELS * sizeof(float))) == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    printf("Channel bank: %d channels, %d frames per block, %d Hz output\n", channels, BLOCK_SIZE, SAMPLE_RATE);
+    printf("%-12s %8s %22s\n", "waveform", "channels", "channel-samples/s");
+
+    // Each group alone, so per-waveform throughput is not averaged with the others
+    for (w = 0; w < BANK_WAVEFORMS; w++) {
+        group_time[w] = 0.0;
+        if (bank.group[w].count == 0) continue;
+        memset(&single, 0, sizeof(single));
+        single.group[w] = bank.group[w];
+        single.count = bank.group[w].count;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (blocks = 0, elapsed = 0.0; elapsed < BANK_BENCH_SECONDS / BANK_WAVEFORMS; blocks++) {
+            render_bank(&single, out, BLOCK_SIZE);
+            if ((blocks & 63) == 0) {
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        group_time[w] = elapsed / blocks;
+        printf("%-12s %8d %22.3e\n", waveform_options[w], single.count, single.count * BLOCK_SIZE / group_time[w]);
+
+        // Sine accuracy against libm, taken from the last rendered frame
+        if (w == 0) {
+            for (c = 0; c < single.count; c++) {
+                double expected = 2.0 * 1000 + 1000 * sin(2 * M_PI * single.group[0].phase[c]);
+                if (fabs(out[(BLOCK_SIZE - 1) * single.count + c] - expected) > max_error) {
+                    max_error = fabs(out[(BLOCK_SIZE - 1) * single.count + c] - expected);
+                }
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (elapsed = 0.0; elapsed < BANK_BENCH_SECONDS; total_blocks++) {
+        render_bank(&bank, out, BLOCK_SIZE);
+        if ((total_blocks & 63) == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-12s %8d %22.3e  (%.0fx real time)\n", "all", channels,
+           (double)channels * BLOCK_SIZE * total_blocks / elapsed,
+           (double)BLOCK_SIZE * total_blocks / SAMPLE_RATE / elapsed);
+    if (bank.group[0].count > 0) printf("Max sine error: %.2e DAC codes at amplitude 1000\n", max_error);
+    free(out);
+}
+
+void deque_push(struct work_deque* deque, int job) {
+    // Owner only. Never overflows, as each instance has at most one job queued
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&deque->jobs[bottom & (HOST_DEQUE_SIZE - 1)], job, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+int deque_pop(struct work_deque* deque) {
+    // Owner only, newest job first. Returns -1 when empty or when a thief took the last job
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    long top;
+    int job = -1;
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top <= bottom) {
+        job = __atomic_load_n(&deque->jobs[bottom & (HOST_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+        if (top == bottom) {
+            // Last job, race thieves for it
+            if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                job = -1;
+            }
+            __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return job;
+}
+
+int deque_steal(struct work_deque* deque) {
+    // Any worker, oldest job first. Returns -1 when empty or when another worker won the job
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    long bottom;
+    int job;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return -1;
+    job = __atomic_load_n(&deque->jobs[top & (HOST_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    return job;
+}
+
+void* host_worker(void* arg) {
+    /*
+    Worker thread of host mode. Releases a job for each of its own instances one block period before
+    the block's deadline, renders its own jobs newest first, and steals the oldest job of another
+    worker when it has none. Sleeps until its next release, at most HOST_IDLE_NS, when there is nothing to do.
+    */
+    struct host_worker* self = arg;
+    struct host_instance* inst;
+    struct timespec wake;
+    uint64_t now, start, next_release;
+    double elapsed;
+    int k, job, victim;
+
+    while (!host_stop) {
+        now = trace_clock();
+        next_release = now + HOST_IDLE_NS;
+        for (k = self->index; k < host_num_instances; k += host_num_workers) {
+            inst = &host_instances[k];
+            if (__atomic_load_n(&inst->queued, __ATOMIC_ACQUIRE)) continue;
+            if (now + inst->period_ns >= inst->deadline) {
+                inst->queued = 1;
+                deque_push(&self->deque, k);
+            }
+            else if (inst->deadline - inst->period_ns < next_release) {
+                next_release = inst->deadline - inst->period_ns;
+            }
+        }
+
+        job = deque_pop(&self->deque);
+        for (victim = (self->index + 1) % host_num_workers; job < 0 && victim != self->index;
+             victim = (victim + 1) % host_num_workers) {
+            if ((job = deque_steal(&host_workers[victim].deque)) >= 0) self->steals++;
+        }
+        if (job < 0) {
+            wake.tv_sec = next_release / 1000000000;
+            wake.tv_nsec = next_release % 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+            continue;
+        }
+
+        inst = &host_instances[job];
+        start = trace_clock();
+        wg_render(inst->engine, inst->block, BLOCK_SIZE);
+        now = trace_clock();
+        elapsed = now - start;
+        inst->render_total += elapsed;
+        if (elapsed > inst->render_max) inst->render_max = elapsed;
+        if (now > inst->deadline) inst->missed++;
+        if (inst->owner != self->index) inst->stolen++;
+        inst->blocks++;
+        inst->deadline += inst->period_ns;
+        self->jobs++;
+        __atomic_store_n(&inst->queued, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void run_host(int instances, int workers) {
+    /*
+    Runs many independent generators in this process for HOST_SECONDS, without hardware.
+    Each instance is a wavegen engine reading the mapped wavetables. They cycle through sine, square,
+    sawtooth and triangular with frequencies spread over the range and output rates of 1, 2, 4 and 8
+    times SAMPLE_RATE, so deadlines fall at different times.
+    Prints render time, deadline misses and stolen blocks per instance, and jobs and steals per worker.
+
+    Parameters:
+        instances: number of generators
+        workers: size of the worker pool
+    */
+    struct host_instance* inst;
+    struct wg_params params;
+    uint64_t epoch;
+    long total_blocks = 0, total_missed = 0, total_steals = 0;
+    int k, started, err = 0;
+
+    host_instances = calloc(instances, sizeof(struct host_instance));
+    host_workers = calloc(workers, sizeof(struct host_worker));
+    host_engines = malloc(instances * wg_engine_size());
+    if (host_instances == NULL || host_workers == NULL || host_engines == NULL) {
+        perror("run_host");
+        free(host_instances);
+        free(host_workers);
+        free(host_engines);
+        return;
+    }
+    host_num_instances = instances;
+    host_num_workers = workers;
+
+    epoch = trace_clock();
+    for (k = 0; k < instances; k++) {
+        inst = &host_instances[k];
+        inst->rate = SAMPLE_RATE << (k % 4);
+        inst->period_ns = 1000000000L / inst->rate * BLOCK_SIZE;
+        params.frequency = FREQUENCY_MAX * (k + 1) / (instances + 1);
+        params.mean = 2.0;
+        params.amplitude = 1000;
+        params.waveform = k % WG_NUM_WAVEFORMS;
+        inst->engine = wg_engine_init(host_engines + k * wg_engine_size(), wg_engine_size(), wavetables,
+                                      inst->rate, &params);
+        if (inst->engine == NULL) {
+            printf("Cannot start instance %d at %d Hz\n", k, inst->rate);
+            free(host_instances);
+            free(host_workers);
+            free(host_engines);
+            return;
+        }
+        inst->deadline = epoch + inst->period_ns;
+        inst->owner = k % workers;
+    }
+
+    printf("Host mode: %d instances on %d workers for %.0f s\n", instances, workers, HOST_SECONDS);
+    for (started = 0; started < workers; started++) {
+        host_workers[started].index = started;
+        if ((err = pthread_create(&host_workers[started].thread, NULL, host_worker, &host_workers[started])) != 0) break;
+    }
+
+    // Without its owner an instance never gets a job, so a partial pool is stopped rather than measured
+    if (err == 0) usleep((useconds_t)(HOST_SECONDS * 1000000));
+    host_stop = 1;
+    for (k = 0; k < started; k++) {
+        pthread_join(host_workers[k].thread, NULL);
+    }
+    if (err != 0) {
+        printf("Cannot start worker %d: %s\n", started, strerror(err));
+        free(host_instances);
+        free(host_workers);
+        free(host_engines);
+        return;
+    }
+
+    printf("%8s %-10s %6s %8s %12s %12s %8s %8s\n",
+           "instance", "waveform", "rate", "blocks", "mean (ns)", "max (ns)", "missed", "stolen");
+    for (k = 0; k < instances; k++) {
+        inst = &host_instances[k];
+        printf("%8d %-10s %6d %8ld %12.0f %12.0f %8ld %8ld\n", k, waveform_options[k % 4], inst->rate, inst->blocks,
+               inst->blocks > 0 ? inst->render_total / inst->blocks : 0.0, inst->render_max, inst->missed, inst->stolen);
+        total_blocks += inst->blocks;
+        total_missed += inst->missed;
+    }
+    for (k = 0; k < workers; k++) {
+        printf("Worker %d: %ld blocks, %ld stolen from other workers\n", k, host_workers[k].jobs, host_workers[k].steals);
+        total_steals += host_workers[k].steals;
+    }
+    printf("Total: %ld blocks, %ld missed deadlines, %ld steals\n", total_blocks, total_missed, total_steals);
+
+    free(host_instances);
+    free(host_workers);
+    free(host_engines);
+}
+
+void trace_register(char* name) {
+    /*
+    Gives the calling thread its own trace ring, so recording never contends with other threads.
+    Does nothing unless tracing was requested with -x.
+
+    Parameters:
+        name: thread name shown in the converted trace
+    */
+    struct trace_ring* ring;
+    int slot;
+
+    if (trace_file == NULL) return;
+    if ((ring = calloc(1, sizeof(struct trace_ring))) == NULL) {
+        perror("trace_register");
+        return;
+    }
+    strncpy(ring->name, name, TRACE_NAME_SIZE - 1);
+    slot = __atomic_fetch_add(&trace_num_rings, 1, __ATOMIC_ACQ_REL);
+    if (slot >= TRACE_THREADS) {
+        free(ring);
+        return;
+    }
+    __atomic_store_n(&trace_rings[slot], ring, __ATOMIC_RELEASE);
+    trace_local = ring;
+}
+
+uint64_t trace_clock() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void trace_record(uint32_t type, uint32_t arg) {
+    // Appends an event to the calling thread's ring, overwriting the oldest once full
+    struct trace_ring* ring = trace_local;
+    struct trace_event* event;
+
+    if (ring == NULL) return;
+    event = &ring->events[ring->head & (TRACE_SIZE - 1)];
+    event->time = trace_clock();
+    event->type = type;
+    event->arg = arg;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_span(uint32_t type, uint64_t start) {
+    // Records an event that began at start, with its duration as the argument
+    struct trace_ring* ring = trace_local;
+    struct trace_event* event;
+
+    if (ring == NULL) return;
+    event = &ring->events[ring->head & (TRACE_SIZE - 1)];
+    event->time = start;
+    event->type = type;
+    event->arg = (uint32_t)(trace_clock() - start);
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void lock_globals() {
+    // Locks global_mutex, recording how long the lock took when this thread is traced or profiled
+    uint64_t start;
+
+    if (trace_local == NULL) {
+        lock_mutex(&global_mutex, LOCK_GLOBAL);
+        return;
+    }
+    start = trace_clock();
+    lock_mutex(&global_mutex, LOCK_GLOBAL);
+    trace_span(TRACE_LOCK_WAIT, start);
+}
+
+void lock_mutex(pthread_mutex_t* mutex, int lock) {
+    /*
+    Locks mutex and, when the calling thread is profiled, counts the acquisition.
+    A trylock first keeps the uncontended path free of clock reads.
+
+    Parameters:
+        mutex: mutex to lock
+        lock: LOCK_GLOBAL, LOCK_BOARD or LOCK_SHUTDOWN
+    */
+    struct lock_stats* stats;
+    uint64_t start, wait;
+
+    if (profile_local == NULL) {
+        pthread_mutex_lock(mutex);
+        return;
+    }
+    stats = &profile_local->locks[lock];
+    stats->acquired++;
+    if (pthread_mutex_trylock(mutex) == 0) return;
+
+    start = trace_clock();
+    pthread_mutex_lock(mutex);
+    wait = trace_clock() - start;
+    stats->contended++;
+    stats->wait_ns += wait;
+    if (wait > stats->max_wait_ns) stats->max_wait_ns = wait;
+}
+
+void wait_condition(pthread_cond_t* cond, pthread_mutex_t* mutex, int lock) {
+    /*
+    Waits on cond and counts the mutex re-acquisition on wakeup as an acquisition of lock.
+    The time spent re-acquiring cannot be told apart from the wait itself, so it is never counted as contended.
+
+    Parameters:
+        cond: condition to wait on
+        mutex: mutex held by the caller, as for pthread_cond_wait
+        lock: LOCK_GLOBAL, LOCK_BOARD or LOCK_SHUTDOWN
+    */
+    pthread_cond_wait(cond, mutex);
+    if (profile_local != NULL) profile_local->locks[lock].acquired++;
+}
+
+void profile_register(char* name) {
+    // Gives the calling thread a profile slot, does nothing unless profiling was requested with -F or -X
+    struct profile_thread* thread;
+    int slot;
+
+    if (!profiling) return;
+    slot = __atomic_fetch_add(&profile_num_threads, 1, __ATOMIC_ACQ_REL);
+    if (slot >= PROFILE_THREADS) return;
+    thread = &profile_threads[slot];
+    strncpy(thread->name, name, TRACE_NAME_SIZE - 1);
+    thread->cpu_available = pthread_getcpuclockid(pthread_self(), &thread->cpu_clock) == 0;
+    profile_local = thread;
+    profile_sample();
+}
+
+void profile_sample() {
+    // Refreshes the calling thread's context switch counts, which only the thread itself can read
+#ifdef RUSAGE_THREAD
+    struct rusage usage;
+
+    if (profile_local == NULL || getrusage(RUSAGE_THREAD, &usage) != 0) return;
+    profile_local->voluntary = usage.ru_nvcsw;
+    profile_local->involuntary = usage.ru_nivcsw;
+#endif
+}
+
+void profile_snapshot() {
+    // Reads every profiled thread's CPU clock, a thread that already exited keeps its last reading
+    struct timespec cpu;
+    int k, count = profile_num_threads < PROFILE_THREADS ? profile_num_threads : PROFILE_THREADS;
+
+    for (k = 0; k < count; k++) {
+        if (profile_threads[k].cpu_available && clock_gettime(profile_threads[k].cpu_clock, &cpu) == 0) {
+            profile_threads[k].cpu_ns = (uint64_t)cpu.tv_sec * 1000000000 + cpu.tv_nsec;
+        }
+    }
+}
+
+void print_profile(FILE* fp) {
+    /*
+    Writes the per-thread table and the per-mutex totals from the last profile_snapshot().
+    Context switch counts are as of each thread's last wakeup.
+    Threads whose CPU clock could not be obtained show n/a for CPU time.
+
+    Parameters:
+        fp: stream to write to
+    */
+    struct lock_stats total;
+    uint64_t elapsed = trace_clock() - profile_start, wait, contended;
+    int k, j, count = profile_num_threads < PROFILE_THREADS ? profile_num_threads : PROFILE_THREADS;
+
+    fprintf(fp, "Thread profile over %.3f s\n", elapsed / 1e9);
+    fprintf(fp, "thread           cpu (ms)   cpu %%    vol cs  invol cs     locks  contended  wait (ms)\n");
+    for (k = 0; k < count; k++) {
+        wait = contended = 0;
+        for (j = 0; j < NUM_LOCKS; j++) {
+            wait += profile_threads[k].locks[j].wait_ns;
+            contended += profile_threads[k].locks[j].contended;
+        }
+        if (profile_threads[k].cpu_available) {
+            fprintf(fp, "%-15s %9.3f %7.2f", profile_threads[k].name,
+                    profile_threads[k].cpu_ns / 1e6, 100.0 * profile_threads[k].cpu_ns / elapsed);
+        } else {
+            fprintf(fp, "%-15s %9s %7s", profile_threads[k].name, "n/a", "n/a");
+        }
+        fprintf(fp, " %9ld %9ld %9llu  %9llu  %9.3f\n", profile_threads[k].voluntary, profile_threads[k].involuntary,
+                (unsigned long long)(profile_threads[k].locks[LOCK_GLOBAL].acquired +
+                                     profile_threads[k].locks[LOCK_BOARD].acquired +
+                                     profile_threads[k].locks[LOCK_SHUTDOWN].acquired),
+                (unsigned long long)contended, wait / 1e6);
+    }
+
+    fprintf(fp, "mutex            acquired  contended  wait (ms)  max wait (us)\n");
+    for (j = 0; j < NUM_LOCKS; j++) {
+        memset(&total, 0, sizeof(total));
+        for (k = 0; k < count; k++) {
+            total.acquired += profile_threads[k].locks[j].acquired;
+            total.contended += profile_threads[k].locks[j].contended;
+            total.wait_ns += profile_threads[k].locks[j].wait_ns;
+            if (profile_threads[k].locks[j].max_wait_ns > total.max_wait_ns) {
+                total.max_wait_ns = profile_threads[k].locks[j].max_wait_ns;
+            }
+        }
+        if (total.acquired == 0) continue;
+        fprintf(fp, "%-15s %9llu  %9llu  %9.3f  %13.1f\n", lock_names[j], (unsigned long long)total.acquired,
+                (unsigned long long)total.contended, total.wait_ns / 1e6, total.max_wait_ns / 1e3);
+    }
+}
+
+void append_profile() {
+    // Appends a fresh report to the -F file, used at exit and on SIGUSR1 while curses owns the terminal
+    FILE* fp;
+
+    profile_snapshot();
+    if ((fp = fopen(profile_file, "a")) == NULL) return;
+    print_profile(fp);
+    fprintf(fp, "\n");
+    fclose(fp);
+}
+
+void request_profile_report(int sig) {
+    profile_report_requested = 1;
+}
+
+bool dump_trace(char* path) {
+    /*
+    Writes every thread's ring to path in the trace.h layout, oldest event first.
+    Safe while threads are still recording, events written during the dump may be partly overwritten.
+
+    Parameters:
+        path: file to write
+
+    Returns:
+        TRUE when the file was written, else FALSE
+    */
+    struct trace_file_header header = {TRACE_MAGIC, TRACE_VERSION, 0, 0};
+    struct trace_thread_header thread;
+    struct trace_ring* ring;
+    uint64_t head, count;
+    size_t first;
+    FILE* fp;
+    int t;
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        perror(path);
+        return FALSE;
+    }
+    for (t = 0; t < TRACE_THREADS; t++) {
+        if (__atomic_load_n(&trace_rings[t], __ATOMIC_ACQUIRE) != NULL) header.num_threads++;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (t = 0; t < TRACE_THREADS && header.num_threads > 0; t++) {
+        if ((ring = __atomic_load_n(&trace_rings[t], __ATOMIC_ACQUIRE)) == NULL) continue;
+        header.num_threads--;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        count = head < TRACE_SIZE ? head : TRACE_SIZE;
+        first = (head - count) & (TRACE_SIZE - 1);
+
+        memset(&thread, 0, sizeof(thread));
+        memcpy(thread.name, ring->name, TRACE_NAME_SIZE);
+        thread.tid = t;
+        thread.num_events = (uint32_t)count;
+        thread.dropped = head - count;
+        fwrite(&thread, sizeof(thread), 1, fp);
+
+        // Ring may wrap, oldest part first
+        if (first + count > TRACE_SIZE) {
+            fwrite(&ring->events[first], sizeof(struct trace_event), TRACE_SIZE - first, fp);
+            fwrite(ring->events, sizeof(struct trace_event), first + count - TRACE_SIZE, fp);
+        }
+        else {
+            fwrite(&ring->events[first], sizeof(struct trace_event), count, fp);
+        }
+    }
+    if (fclose(fp) != 0) {
+        perror(path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void request_trace_dump(int sig) {
+    trace_dump_requested = 1;
+}
+
+void draw_scope(const float* samples) {
+    // ASCII trace of the snapshot, scaled to its own min and max
+    char grid[SCOPE_ROWS][SCOPE_COLS + 1];
+    float min = samples[0], max = samples[0];
+    int row, col;
+
+    for (col = 0; col < SCOPE_SIZE; col++) {
+        if (samples[col] < min) min = samples[col];
+        if (samples[col] > max) max = samples[col];
+    }
+    memset(grid, ' ', sizeof(grid));
+    for (col = 0; col < SCOPE_COLS; col++) {
+        row = (max > min) ? (int)((max - samples[col * SCOPE_SIZE / SCOPE_COLS]) / (max - min) * (SCOPE_ROWS - 1) + 0.5) : SCOPE_ROWS / 2;
+        grid[row][col] = '*';
+    }
+
+    printw("\n\nScope (%.0f ms, codes %.0f - %.0f)\n", 1000.0 * SCOPE_SIZE * SCOPE_DECIMATION / SAMPLE_RATE, min, max);
+    for (row = 0; row < SCOPE_ROWS; row++) {
+        grid[row][SCOPE_COLS] = '\0';
+        printw("|%s|\n", grid[row]);
+    }
+}
+
+void draw_spectrum(const float* samples) {
+    // Hann windowed FFT of the snapshot drawn as bars in dB below the strongest bin
+    double re[SCOPE_SIZE], im[SCOPE_SIZE], bars[SPECTRUM_BARS];
+    double mean_code = 0.0, peak = 1e-12, magnitude;
+    int k, bar, row, height;
+
+    for (k = 0; k < SCOPE_SIZE; k++) mean_code += samples[k];
+    mean_code /= SCOPE_SIZE;
+    for (k = 0; k < SCOPE_SIZE; k++) {
+        re[k] = (samples[k] - mean_code) * (0.5 - 0.5 * cos(2 * M_PI * k / SCOPE_SIZE));
+        im[k] = 0.0;
+    }
+    fft(re, im, SCOPE_SIZE);
+
+    for (bar = 0; bar < SPECTRUM_BARS; bar++) bars[bar] = 0.0;
+    for (k = 1; k < SCOPE_SIZE / 2; k++) {
+        magnitude = sqrt(re[k] * re[k] + im[k] * im[k]);
+        bar = k * SPECTRUM_BARS / (SCOPE_SIZE / 2);
+        if (magnitude > bars[bar]) bars[bar] = magnitude;
+        if (magnitude > peak) peak = magnitude;
+    }
+
+    printw("\nSpectrum (0 - %.0f Hz, %.0f dB)\n", SAMPLE_RATE / 2.0 / SCOPE_DECIMATION, SPECTRUM_RANGE_DB);
+    for (row = SPECTRUM_ROWS; row > 0; row--) {
+        printw("|");
+        for (bar = 0; bar < SPECTRUM_BARS; bar++) {
+            height = bars[bar] > 0 ? (int)((20 * log10(bars[bar] / peak) + SPECTRUM_RANGE_DB) / SPECTRUM_RANGE_DB * SPECTRUM_ROWS + 0.5) : 0;
+            printw(height >= row ? "##" : "  ");
+        }
+        printw("|\n");
+    }
+}
+
+void fft(double* re, double* im, int n) {
+    /*
+    In-place iterative radix-2 FFT.
+
+    Parameters:
+        re: real parts, replaced by the transform
+        im: imaginary parts, replaced by the transform
+        n: number of points, a power of two
+    */
+    double wr, wi, step_r, step_i, tr, ti, tmp;
+    int i, j, bit, len, k;
+
+    // Bit reversal permutation
+    for (i = 1, j = 0; i < n; i++) {
+        for (bit = n >> 1; j & bit; bit >>= 1) j ^= bit;
+        j |= bit;
+        if (i < j) {
+            tmp = re[i]; re[i] = re[j]; re[j] = tmp;
+            tmp = im[i]; im[i] = im[j]; im[j] = tmp;
         }
-       current_waveform = promptInt("Input: ", 0, len_waveform-1);
     }
-    
-    // PCI Setup
-    memset(&info,0,sizeof(info));
-	if(pci_attach(0)<0) {
- 		 perror("pci_attach");
- 		 exit(EXIT_FAILURE);
- 	 }
 
-	info.VendorId=0x1307;
-	info.DeviceId=0x01;
+    for (len = 2; len <= n; len <<= 1) {
+        step_r = cos(-2 * M_PI / len);
+        step_i = sin(-2 * M_PI / len);
+        for (i = 0; i < n; i += len) {
+            wr = 1.0;
+            wi = 0.0;
+            for (k = 0; k < len / 2; k++) {
+                tr = re[i + k + len / 2] * wr - im[i + k + len / 2] * wi;
+                ti = re[i + k + len / 2] * wi + im[i + k + len / 2] * wr;
+                re[i + k + len / 2] = re[i + k] - tr;
+                im[i + k + len / 2] = im[i + k] - ti;
+                re[i + k] += tr;
+                im[i + k] += ti;
+                tmp = wr * step_r - wi * step_i;
+                wi = wr * step_i + wi * step_r;
+                wr = tmp;
+            }
+        }
+    }
+}
 
-	if ((hdl=pci_attach_device(0, PCI_SHARE|PCI_INIT_ALL, 0, &info))==0) {
-		 perror("pci_attach_device");
- 		 exit(EXIT_FAILURE);
-  	}	
+#ifdef SIMULATION
+// Simulated Backend
+// Each board is SIM_BOARD_PORTS of sim_io and each base address region 0x100 ports of it.
+// DAC and DIO writes land in sim_io, and DIO_PORTB reads the level driven by sim_trigger_line().
+// SIM_BOARDS in the environment sets how many boards are found, default 1.
+// SIM_DAC_LOG names a file that every first board DAC code is appended to with its sample, for -V.
 
-	for(i=0;i<5;i++) {
- 		badr[i]=PCI_IO_ADDR(info.CpuBaseAddress[i]);
- 	 }
- 
-	// Map I/O base address to user space						
-	for(i=0;i<5;i++) {
- 		 iobase[i]=mmap_device_io(0x0f,badr[i]);	
-  	}				
-  	
-  	// Modify thread control privity
-	if(ThreadCtl(_NTO_TCTL_IO,0)==-1) {
-  		perror("Thread Control");
- 		exit(EXIT_FAILURE);
-  	}
+int pci_attach(unsigned flags) {
+    char* boards_env = getenv("SIM_BOARDS");
+    char* log_env = getenv("SIM_DAC_LOG");
 
-    /* Curses Initialisations */
-    initscr();
-    raw();
-    keypad(stdscr, TRUE);
-    noecho();
+    if (log_env != NULL && (sim_dac_log = fopen(log_env, "wb")) == NULL) perror(log_env);
+    if (boards_env != NULL) sim_boards = atoi(boards_env);
+    if (sim_boards < 1) sim_boards = 1;
+    if (sim_boards > MAX_BOARDS) sim_boards = MAX_BOARDS;
+    return 0;
+}
 
-    pthread_create(&kb_thread, NULL, get_keyboard_input, NULL);
-    pthread_create(&waveform_thread, NULL, waveform_generator, NULL);
-    //pthread_create(&output_thread, NULL, output_result, NULL);
-    pthread_create(&shutdown_thread, NULL, shutdown, NULL);
+void* pci_attach_device(void* hdl, unsigned flags, unsigned idx, struct pci_dev_info* info) {
+    int bar;
+    if (idx >= sim_boards) return NULL;
+    for (bar = 0; bar < 6; bar++) {
+        info->CpuBaseAddress[bar] = idx * SIM_BOARD_PORTS + bar * 0x100;
+    }
+    return info;
+}
 
-    // Wait for shutdown condition
-    pthread_mutex_lock(&shutdown_mutex);
-    pthread_cond_wait(&shutdown_cond, &shutdown_mutex);
-    pthread_mutex_unlock(&shutdown_mutex);
+int pci_detach_device(void* hdl) {
+    return 0;
+}
 
-    // Shutdown all threads
-    pthread_cancel(kb_thread); 
-    pthread_cancel(waveform_thread);
-    //pthread_cancel(output_thread);
-    pthread_cancel(shutdown_thread);
+uintptr_t mmap_device_io(size_t len, uint64_t io) {
+    return io;
+}
 
-    endwin();
-	
-	/*
-    out16(DA_CTLREG,(short)0x0a23);
-	out16(DA_FIFOCLR,(short) 0);
-	out16(DA_Data, 0x8fff);															
-  
-	out16(DA_CTLREG,(short)0x0a43);
-	out16(DA_FIFOCLR,(short) 0);
-	out16(DA_Data, 0x8fff);
-	*/
-																																						
-	pci_detach_device(hdl);
-    printf("Ending Program.\n");
-    return EXIT_SUCCESS;
+int ThreadCtl(int cmd, void* data) {
+    return 0;
 }
 
-void usage(char* progname) {
-    printf("Usage: %s [-f frequency] [-m mean] [-a amplitude] [-w waveform] [-s setting_file] [-h]\n", progname);
-	printf("[-s setting_file]: (file) Default setting for frequency, mean and amplitude. Overwritten when corresponding option is used during program call.\n");
-	printf("[-f frequency]: (float) Frequency of wave (Hz). Range: %f - %f\n", FREQUENCY_MIN, FREQUENCY_MAX);
-	printf("[-m mean]: (float) Prescaled mean of wave. Range: %f - %f\n", MEAN_MIN, MEAN_MAX);
-	printf("[-a amplitude]: (unsigned int) Amplitude of wave. Range: %d - %d\n", AMPLITUDE_MIN, AMPLITUDE_MAX);
-    printf("[-w waveform]: (string) Type of waveform. Options: sine, square, sawtooth, triangular.\n");
-    printf("[-h]: Display this information..\n");
-    exit(EXIT_FAILURE);
+unsigned delay(unsigned msec) {
+    usleep(msec * 1000);
+    return 0;
 }
 
-bool input(char* var_pointer) {
+void out8(uintptr_t port, uint8_t val) {
+    sim_io[port % SIM_IO_PORTS] = val;
+}
+
+void out16(uintptr_t port, uint16_t val) {
+    struct capture_entry entry;
+
+    sim_io[port % SIM_IO_PORTS] = val;
+
+    // Channel 0 data of the first board, selected by the control word write_dac() writes before it
+    if (port != 4 * 0x100 || sim_io[1 * 0x100 + 8] != 0x0a23) return;
+    if (sim_dac_log != NULL) {
+        entry.sample = sample_clock;
+        entry.code = val;
+        entry.reserved = 0;
+        fwrite(&entry, sizeof(entry), 1, sim_dac_log);
+    }
+    if (stress.running) stress_write(val);
+}
+
+uint8_t in8(uintptr_t port) {
+    if (port % SIM_BOARD_PORTS == 3 * 0x100 + 5) return sim_read_dio(NULL);      // DIO_PORTB of any board
+    return sim_io[port % SIM_IO_PORTS];
+}
+
+void* sim_trigger_line() {
+    // Toggles the simulated trigger line at jittered intervals so edges fall between sample ticks
+    unsigned int seed = 1;
+    struct timespec edge;
+
+    while (TRUE) {
+        usleep((SIM_TRIGGER_PERIOD_MS / 2 + rand_r(&seed) % SIM_TRIGGER_PERIOD_MS) * 1000);
+        clock_gettime(CLOCK_MONOTONIC, &edge);
+        pthread_mutex_lock(&sim_dio_mutex);
+        sim_dio_edge = edge;
+        sim_dio_in ^= TRIGGER_LINE;
+        pthread_mutex_unlock(&sim_dio_mutex);
+    }
+}
+
+uint8_t sim_read_dio(struct timespec* edge) {
+    // Reads the simulated DIO_PORTB level, and when edge is not NULL the time of the change that set it
+    uint8_t level;
+
+    pthread_mutex_lock(&sim_dio_mutex);
+    level = sim_dio_in;
+    if (edge != NULL) *edge = sim_dio_edge;
+    pthread_mutex_unlock(&sim_dio_mutex);
+    return level;
+}
+
+// Stress Run
+// The live generator drives the simulated DAC while updater threads change the parameters through
+// global_mutex the way keys and commands do. out16() hands every first board channel 0 code to
+// stress_write(), which checks it against the parameters the generator rendered it with.
+
+bool parse_stress(char* spec) {
     /*
-    Prompts for keyboard inputs from user.
-    Stores input within a given address in string format.
-    
+    Parses a stress run of the form seconds:updaters:rate:mode[:p99_us].
+
     Parameters:
-        var_pointer: address to store user input in
+        spec: stress string
 
     Returns:
-        TRUE when input is sucessful, else FALSE
+        TRUE when spec is valid, else FALSE
     */
-    char value[MAX_INPUT] = "";
-    char c;
+    char* fields[5];
+    int k;
 
-    // Read input from stdin as string
-    fgets(value, MAX_INPUT, stdin);
+    for (k = 0; k < 5; k++) {
+        fields[k] = strtok(k == 0 ? spec : NULL, ":");
+        if (fields[k] == NULL && k < 4) {
+            printf("Stress requires seconds:updaters:rate:mode[:p99_us]\n");
+            return FALSE;
+        }
+    }
 
-    // If last character in value is not \n, input buffer is not cleared.
-    if (!strchr(value, '\n')) {
-        printf("Exceed maximum input size\n\n");
-        
-        // Clear Input buffer
-        while ((c = getchar()) != '\n' && c != EOF);
+    if (!convertNum(fields[0], &stress.seconds, FLOAT, 0.1, 3600.0)) return FALSE;
+    if (!convertNum(fields[1], &stress.updaters, INTEGER, 1, STRESS_MAX_UPDATERS)) return FALSE;
+    if (!convertNum(fields[2], &stress.rate, INTEGER, 0, STRESS_MAX_RATE)) return FALSE;
+
+    for (k = 0; k < 2 && strcmp(fields[3], stress_modes[k]) != 0; k++);
+    if (k == 2) {
+        printf("Undefined stress mode %s\n", fields[3]);
         return FALSE;
     }
+    stress.mode = k;
 
-    sscanf(value, "%s", var_pointer);
+    if (fields[4] != NULL && !convertNum(fields[4], &stress.p99_limit_us, FLOAT, 0.0, 1e9)) return FALSE;
     return TRUE;
 }
 
-bool convertNum(char* input, void* var_pointer, int format, float min, float max) {
+bool run_stress(uint32_t seed) {
     /*
-    Converts input into desired format and stores value within a given address.
-    Accepts INTEGER or FLOAT format.
+    Runs the generator and the other boards' output threads for stress.seconds with stress.updaters
+    threads changing frequency, mean, amplitude and waveform, then reports how changes reached the DAC
+    and the per-thread profile, which counts every global_mutex acquisition and wait.
 
     Parameters:
-        input: string to convert to number format
-        var_pointer: address to store converted input in
-        format: format for conversion of input
-        min: minimum value to accept
-        max: maximum value to accept
+        seed: seeds the updaters, so a run's sequence of changes can be repeated
 
     Returns:
-        TRUE when input is in correct format, else FALSE
+        TRUE when no glitch was found and the p99 latency is within the limit, else FALSE
     */
-    char format_type[20] = "";
-    char c;
-    
-    if (format == INTEGER) {
-        int temp;
-        int* var_pointer_2 = (int*)var_pointer;
-        sprintf(format_type, "integer");
-        if (sscanf(input, "%d %c", &temp, &c) == 1) {
-            if (temp < (int) min) {
-                printf("%s is less than minimum number %d\n\n", input, (int) min);
-                return FALSE;
-            }
-            else if (temp > (int) max) {
-                printf("%s is greater than maximum number %d\n\n", input, (int) max);
-                return FALSE;
-            }
-            *var_pointer_2 = temp;
-            return TRUE;
-        }
+    struct stress_updater updaters[STRESS_MAX_UPDATERS];
+    pthread_t generator;
+    long published = 0;
+    double p99_us;
+    bool pass;
+    int k;
+
+    if ((stress.latency_ns = malloc(STRESS_MAX_LATENCIES * sizeof(uint64_t))) == NULL) {
+        perror("run_stress");
+        return FALSE;
     }
-    else if (format == FLOAT) {
-        float temp;
-        float* var_pointer_2 = (float*)var_pointer;
-        sprintf(format_type, "float");
-        if (sscanf(input, "%f %c", &temp, &c) == 1) {
-            if (temp < min) {
-                printf("%s is less than minimum number %f\n\n", input, min);
-                return FALSE;
-            }
-            else if (temp > max) {
-                printf("%s is greater than maximum number %f\n\n", input, max);
-                return FALSE;
-            }
-            *var_pointer_2 = temp;
-            return TRUE;
-        }
+
+    printf("Stress: %d updater%s at ", stress.updaters, stress.updaters == 1 ? "" : "s");
+    if (stress.rate > 0) printf("%d updates/s each", stress.rate);
+    else printf("full speed");
+    printf(", %s parameters, %.1f s at %d Hz on %d board%s\n", stress_modes[stress.mode], stress.seconds,
+           SAMPLE_RATE, num_boards, num_boards == 1 ? "" : "s");
+    fflush(stdout);
+
+    // The starting parameters are published like any change, before a thread can render them
+    lock_globals();
+    stress_publish(param_version, trace_clock());
+    stress.version = param_version - 1;
+    pthread_mutex_unlock(&global_mutex);
+
+    profiling = TRUE;
+    profile_start = trace_clock();
+    stress.running = TRUE;
+    pthread_create(&generator, NULL, waveform_generator, NULL);
+    for (k = 1; k < num_boards; k++) {
+        pthread_create(&boards[k].thread, NULL, board_output, &boards[k]);
     }
-    else {
-        printf("Unsupported format\n\n");
-        return FALSE;
+    for (k = 0; k < stress.updaters; k++) {
+        memset(&updaters[k], 0, sizeof(updaters[k]));
+        updaters[k].index = k;
+        updaters[k].seed = seed * STRESS_MAX_UPDATERS + k;
+        pthread_create(&updaters[k].thread, NULL, stress_updater, &updaters[k]);
     }
 
-    printf("Invalid format. %s is not %s\n\n", input, format_type);
-    return FALSE;
+    usleep((useconds_t)(stress.seconds * 1000000));
+
+    // CPU clocks are read while every thread is alive. Updaters stop first, a generator cancelled
+    // in its DC hold wait keeps global_mutex
+    profile_snapshot();
+    stress.running = FALSE;
+    for (k = 0; k < stress.updaters; k++) {
+        pthread_join(updaters[k].thread, NULL);
+        published += updaters[k].updates;
+    }
+    pthread_cancel(generator);
+    pthread_join(generator, NULL);
+    for (k = 1; k < num_boards; k++) {
+        pthread_cancel(boards[k].thread);
+        pthread_join(boards[k].thread, NULL);
+    }
+
+    printf("Updates: %ld published, %llu rendered, %llu superseded before any block used them\n", published,
+           (unsigned long long)stress.versions_seen, (unsigned long long)(published + 1 - stress.versions_seen));
+
+    qsort(stress.latency_ns, stress.latency_count, sizeof(uint64_t), compare_u64);
+    p99_us = percentile(stress.latency_ns, stress.latency_count, 0.99) / 1000;
+    if (stress.latency_count > 0) {
+        printf("Latency (update to first DAC write, us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f over %llu\n",
+               percentile(stress.latency_ns, stress.latency_count, 0.50) / 1000,
+               percentile(stress.latency_ns, stress.latency_count, 0.90) / 1000, p99_us,
+               percentile(stress.latency_ns, stress.latency_count, 0.999) / 1000,
+               stress.latency_ns[stress.latency_count - 1] / 1000.0, (unsigned long long)stress.latency_count);
+    }
+    else printf("Latency: no update reached the output\n");
+    if (stress.unmatched > 0) {
+        printf("Latency: %llu written versions were not in the slot ring and were not checked\n",
+               (unsigned long long)stress.unmatched);
+    }
+    printf("Glitches: %llu in %llu checked code pairs (worst %.1f codes over bound), %llu parameter steps (max %u codes)\n",
+           (unsigned long long)stress.glitches, (unsigned long long)stress.checked, stress.worst_excess,
+           (unsigned long long)stress.transitions, stress.max_transition);
+    if (watchdog.transitions > 0) {
+        printf("Quality watchdog: %ld transitions, ending at %s\n", watchdog.transitions, quality_names[quality]);
+    }
+    if (num_boards > 1) print_board_timing();
+    print_profile(stdout);
+    if (profile_file != NULL) append_profile();
+
+    pass = stress.glitches == 0 && (stress.p99_limit_us <= 0 || p99_us <= stress.p99_limit_us);
+    if (stress.p99_limit_us > 0 && p99_us > stress.p99_limit_us) {
+        printf("p99 latency over the %.1f us limit\n", stress.p99_limit_us);
+    }
+    printf("%s\n", pass ? "PASS" : "FAIL");
+
+    free(stress.latency_ns);
+    return pass;
 }
 
-int promptInt(char* msg, int min, int max) {
+void* stress_updater(void* arg) {
     /*
-    Prompts for int input from user.
-    Parameters:
-        msg: message to display to user during the prompt
-        min: minimum value to accept
-        max: maximum value to accept
-
-    Returns:
-        int input by user
+    Changes the parameters until the run ends, at stress.rate on absolute deadlines or back to back.
+    The change is timed from before global_mutex is taken, so waiting for it counts towards the latency.
     */
-    int result;
-    char input_str[MAX_INPUT] = "";
-    while (TRUE) {
-        printf("%s", msg);
-        if (input(input_str)) {
-            // printf("%s\n", input_str);
-            if (convertNum(input_str, &result, INTEGER, min, max)) {
-                break;
-            }
+    struct stress_updater* self = arg;
+    struct stress_slot next;
+    struct timespec deadline;
+    uint64_t published_ns;
+    char name[TRACE_NAME_SIZE];
+    long period_ns = stress.rate > 0 ? 1000000000L / stress.rate : 0;
+
+    snprintf(name, sizeof(name), "updater %d", self->index);
+    profile_register(name);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (stress.running) {
+        stress_params(&next, self);
+        published_ns = trace_clock();
+        lock_globals();
+        frequency = next.frequency;
+        mean = next.mean;
+        amplitude = next.amplitude;
+        current_waveform = next.waveform;
+        notify_param_change();
+        stress_publish(param_version, published_ns);
+        pthread_mutex_unlock(&global_mutex);
+        self->updates++;
+
+        if (period_ns > 0) {
+            advance_deadline(&deadline, period_ns);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
         }
     }
-    return result;
+    profile_sample();
+    return NULL;
 }
 
-float promptFloat(char* msg, float min, float max) {
+void stress_params(struct stress_slot* next, struct stress_updater* self) {
     /*
-    Prompts for float input from user.
-    Parameters:
-        msg: message to display to user during the prompt
-        min: minimum value to accept
-        max: maximum value to accept
-
-    Returns:
-        float input by user
+    Random mode draws every parameter from its range. Adversarial mode walks the corners: frequency,
+    amplitude and mean flip between their extremes on different bits of the count, and the waveform cycles.
+    Amplitude is capped so (mean + 1) * amplitude, the peak of every checked shape, fits the 16-bit DAC.
     */
-    float result;
-    char input_str[MAX_INPUT] = "";
-    while (TRUE) {
-        printf("%s", msg);
-        if (input(input_str)) {
-            if (convertNum(input_str, &result, FLOAT, min, max)) {
-                break;
-            }
-        }
+    long count = self->updates;
+
+    if (stress.mode == STRESS_RANDOM) {
+        next->frequency = FREQUENCY_MIN + (FREQUENCY_MAX - FREQUENCY_MIN) * rand_r(&self->seed) / RAND_MAX;
+        next->mean = MEAN_MIN + (MEAN_MAX - MEAN_MIN) * rand_r(&self->seed) / RAND_MAX;
+        next->amplitude = rand_r(&self->seed) % ((unsigned int)(AMPLITUDE_MAX / (next->mean + 1)) + 1);
+        next->waveform = rand_r(&self->seed) % STRESS_WAVEFORMS;
+        return;
     }
-    return result;
+    next->frequency = count & 1 ? FREQUENCY_MAX : FREQUENCY_MIN;
+    next->mean = count & 4 ? MEAN_MAX : MEAN_MIN;
+    next->amplitude = count & 2 ? (unsigned int)(AMPLITUDE_MAX / (next->mean + 1)) : AMPLITUDE_MIN;
+    next->waveform = (count >> 3) % STRESS_WAVEFORMS;
 }
 
-void* get_keyboard_input() {
-    int ch;
-    while((ch = getch()) != 'E') {
-        pthread_mutex_lock(&global_mutex);
-        switch(ch) {
-            case KEY_UP:
-                amplitude += AMPLITUDE_STEP_SIZE;
-                break;
-            case KEY_DOWN:
-                amplitude -= AMPLITUDE_STEP_SIZE;
-                break;
-            case KEY_RIGHT:
-                frequency += FREQUENCY_STEP_SIZE;
-                break;
-            case KEY_LEFT:
-                frequency -= FREQUENCY_STEP_SIZE;
-                break;
-            case 'w':
-            case 'W':
-                mean += MEAN_STEP_SIZE;
-                break;
-            case 's':
-            case 'S':
-                mean -= MEAN_STEP_SIZE;
-                break;
-            case 'a':
-            case 'A':
-                current_waveform -= 1;
-                break;
-            case 'd':
-            case 'D':
-                current_waveform += 1;
-                break;
-            // default:    
-            //     printw("\nThe pressed key is %c",ch);
-        }
-        constrain(&frequency, FREQUENCY_MIN, FREQUENCY_MAX, FLOAT);
-        constrain(&mean, MEAN_MIN, MEAN_MAX, FLOAT);
-        constrain(&amplitude, AMPLITUDE_MIN, AMPLITUDE_MAX, INTEGER);
-        constrain(&current_waveform, 0, len_waveform-1, INTEGER);
-        pthread_mutex_unlock(&global_mutex);
-    }
+void stress_publish(unsigned long version, uint64_t published_ns) {
+    // Records the current parameters as version, caller must hold global_mutex
+    struct stress_slot* slot = &stress.slots[version & (STRESS_SLOTS - 1)];
 
-    // Signal main thread to shutdown all threads and exit program
-    pthread_mutex_lock(&shutdown_mutex);
-    pthread_cond_signal(&shutdown_cond);
-    pthread_mutex_unlock(&shutdown_mutex);
-    pthread_exit(NULL);
+    __atomic_store_n(&slot->version, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->published_ns = published_ns;
+    slot->frequency = frequency;
+    slot->mean = mean;
+    slot->amplitude = amplitude;
+    slot->waveform = current_waveform;
+    __atomic_store_n(&slot->version, version, __ATOMIC_RELEASE);
 }
 
-void constrain(void* var_pointer, float min, float max, int format) {
-    if (format == INTEGER) {
-        int* var_pointer_2 = (int*)var_pointer;
-        if (*var_pointer_2 < (int) min) {
-            *var_pointer_2 = (int) min;
-        }
-        else if (*var_pointer_2 > (int) max) {
-            *var_pointer_2 = (int) max;
-        }
+void stress_write(unsigned int code) {
+    /*
+    Checks one code on its way to the DAC, called by the generator through out16().
+    Within one parameter version, consecutive codes of sine and triangular may differ by at most their
+    steepest slope, anything larger is a glitch. Steps across a version change are legitimate parameter
+    jumps and are only measured.
+    */
+    unsigned int step;
+    double excess;
+    bool changed = FALSE;
+
+    if (output_version != stress.version) {
+        stress_start_version(output_version);
+        changed = stress.samples > 0;
     }
-    else if (format == FLOAT) {
-        float* var_pointer_2 = (float*)var_pointer;
-        if (*var_pointer_2 < min) {
-            *var_pointer_2 = min;
+
+    if (stress.samples > 0) {
+        step = code > stress.last_code ? code - stress.last_code : stress.last_code - code;
+        if (changed) {
+            stress.transitions++;
+            if (step > stress.max_transition) stress.max_transition = step;
         }
-        else if (*var_pointer_2 > max) {
-            *var_pointer_2 = max;
+        else if (stress.bound >= 0) {
+            stress.checked++;
+            excess = step - stress.bound;
+            if (excess > 0) {
+                stress.glitches++;
+                if (excess > stress.worst_excess) stress.worst_excess = excess;
+            }
         }
     }
-    else {
-        printf("Unsupported format\n\n");
-    }
+    stress.last_code = code;
+    stress.samples++;
 }
 
-unsigned int sine(int step) {
-    double result = sin(step * STEP_SIZE);
-    unsigned int scaled_result = (unsigned int)((result + mean) * amplitude);//2
-    delay((1000/frequency));
-    return scaled_result;
-}
+void stress_start_version(unsigned long version) {
+    // Looks up the parameters of a newly written version and records how long they took to reach the DAC
+    struct stress_slot* slot = &stress.slots[version & (STRESS_SLOTS - 1)];
+    struct stress_slot params;
+    uint64_t now = trace_clock();
+
+    stress.version = version;
+    stress.versions_seen++;
+    stress.bound = -1;
 
-unsigned int square(int step) {
-    double result;
-    unsigned int scaled_result;
-    static const int half_step_size = STEPS/2;
-    if (step < half_step_size) {
-        result = - 1.0;
+    if (__atomic_load_n(&slot->version, __ATOMIC_ACQUIRE) != version) {
+        stress.unmatched++;
+        return;
     }
-    else {
-        result = 1.0;
+    params = *slot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->version, __ATOMIC_RELAXED) != version) {
+        stress.unmatched++;
+        return;
+    }
+
+    stress.bound = stress_bound(&params);
+    if (stress.latency_count < STRESS_MAX_LATENCIES && now > params.published_ns) {
+        stress.latency_ns[stress.latency_count++] = now - params.published_ns;
     }
-    scaled_result = (unsigned int)((result + mean) * amplitude); //2.0
-    // delay((10/frequency)-2);
-    return scaled_result;
 }
 
-unsigned int sawtooth(int step) {
-    double result = -1.0 + ((double)step)/((double)(STEPS-1)) * 2.0;
-    unsigned int scaled_result = (unsigned int)((result + mean) * amplitude); //2.0
-    delay(1000/frequency);
-    return scaled_result;
+double stress_bound(const struct stress_slot* params) {
+    /*
+    Largest step between two codes the generator may write for these parameters, -1 when unchecked.
+    Table reads add up to one entry of the smallest table the watchdog may switch to; square and
+    sawtooth have a legitimate jump every period and are not checked.
+    */
+    double phase_inc = params->frequency / SAMPLE_RATE;
+
+    switch (params->waveform) {
+        case WG_SINE:
+            return params->amplitude * (2 * M_PI * phase_inc + 2 * M_PI / SMALL_TABLE_SIZE) * STRESS_SLOPE_MARGIN +
+                   STRESS_CODE_MARGIN;
+        case WG_TRIANGULAR:
+            return params->amplitude * (4 * phase_inc + 4.0 / SMALL_TABLE_SIZE) * STRESS_SLOPE_MARGIN + STRESS_CODE_MARGIN;
+        default:
+            return -1;
+    }
 }
 
-unsigned int triangular(int step) {
-    double result = asin(sin(step * STEP_SIZE));
-    unsigned int scaled_result = (unsigned int)((result + mean) * 2 * amplitude/ M_PI); //2.0
-    delay(1000/frequency);
-    return scaled_result;
+int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return x < y ? -1 : x > y;
 }
 
-void* output_result() {
-    while (TRUE) {
-       clear();
-        printw("Press E to Exit\n\n");
-        printw("Up/Down: Change Amplitude\n");
-        printw("Left/Right: Change Frequency\n");
-        printw("W/S: Change Mean\n");
-        printw("A/D: Change Waveform\n");
-        pthread_mutex_lock(&global_mutex);
-        printw("\nFrequency: %f",frequency);
-        printw("\nMean: %f",mean);
-        printw("\nAmplitude: %d",amplitude);
-        printw("\nWaveform: %s",waveform_options[current_waveform]);
-        //printw("\n%f",1000000.0/frequency/STEPS);
-        pthread_mutex_unlock(&global_mutex);
-      
-        // Update rate at 100 Hz
-        //usleep(10000);
-       sleep(0.5);
-       refresh();
-    }
-}
\ No newline at end of file
+double percentile(const uint64_t* sorted, uint64_t n, double p) {
+    // Nearest-rank percentile of an ascending array, 0 when it is empty
+    uint64_t rank;
+
+    if (n == 0) return 0;
+    rank = (uint64_t)ceil(p * n);
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1];
+}
+#endif
@@ -1,31 +1,33 @@
-// gcc -o kb keyboard_input.c -l ncurses
+// gcc -o kb keyboard_input.c wavegen.c -l ncurses -lm
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <ncurses.h>
+#include "wavegen.h"
 
-#define INTEGER 0
-#define FLOAT 1
+#define INTEGER WG_INTEGER
+#define FLOAT WG_FLOAT
 
-#define FREQUENCY_MIN 0.0
-#define FREQUENCY_MAX 100.0
+// Ranges come from the engine library so every front end agrees on them
+#define FREQUENCY_MIN WG_FREQUENCY_MIN
+#define FREQUENCY_MAX WG_FREQUENCY_MAX
 #define FREQUENCY_STEPS 100
 #define FREQUENCY_STEP_SIZE (FREQUENCY_MAX-FREQUENCY_MIN)/FREQUENCY_STEPS 
-#define MEAN_MIN 1.0
-#define MEAN_MAX 10.0
+#define MEAN_MIN WG_MEAN_MIN
+#define MEAN_MAX WG_MEAN_MAX
 #define MEAN_STEPS 100
 #define MEAN_STEP_SIZE (MEAN_MAX-MEAN_MIN)/MEAN_STEPS 
-#define AMPLITUDE_MIN 0
-#define AMPLITUDE_MAX 4095
+#define AMPLITUDE_MIN WG_AMPLITUDE_MIN
+#define AMPLITUDE_MAX WG_AMPLITUDE_MAX
 #define AMPLITUDE_STEPS 100
 #define AMPLITUDE_STEP_SIZE (AMPLITUDE_MAX-AMPLITUDE_MIN)/AMPLITUDE_STEPS 
 
 float mean = 1.0;
 float frequency = 0.0;
 unsigned int amplitude = 0;
-char* waveform_options[] = {"sine", "square", "triangular", "sawtooth"};
+char* waveform_options[] = {"sine", "square", "sawtooth", "triangular"};      // Same order as the engine library
 int current_waveform = 0;
 const unsigned int len_waveform = sizeof(waveform_options)/sizeof(waveform_options[0]);
 
@@ -89,27 +91,11 @@ int main() {
 }
 
 void constrain(void* var_pointer, float min, float max, int format) {
-    if (format == INTEGER) {
-        int* var_pointer_2 = (int*)var_pointer;
-        if (*var_pointer_2 < (int) min) {
-            *var_pointer_2 = (int) min;
-        }
-        else if (*var_pointer_2 > (int) max) {
-            *var_pointer_2 = (int) max;
-        }
-    }
-    else if (format == FLOAT) {
-        float* var_pointer_2 = (float*)var_pointer;
-        if (*var_pointer_2 < min) {
-            *var_pointer_2 = min;
-        }
-        else if (*var_pointer_2 > max) {
-            *var_pointer_2 = max;
-        }
-    }
-    else {
+    if (format != INTEGER && format != FLOAT) {
         printf("Unsupported format\n\n");
+        return;
     }
+    wg_constrain(var_pointer, format, min, max);
 }
 
 void print_keyboard_usage() {
@@ -1,4 +1,4 @@
-// gcc -o mt multithreading.c -lncurses -lpthread
+// gcc -o mt multithreading.c wavegen.c -lncurses -lpthread -lm
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,28 +8,46 @@
 #include <ctype.h>
 #include <pthread.h>
 #include <ncurses.h>
+#include <stdint.h>
+#include <time.h>
+#include "wavegen.h"
 
 #define MAX_INPUT 20
-#define INTEGER 0
-#define FLOAT 1
+#define INTEGER WG_INTEGER
+#define FLOAT WG_FLOAT
 
-#define FREQUENCY_MIN 0.0
-#define FREQUENCY_MAX 100.0
+// Ranges come from the engine library so every front end agrees on them
+#define FREQUENCY_MIN WG_FREQUENCY_MIN
+#define FREQUENCY_MAX WG_FREQUENCY_MAX
 #define FREQUENCY_STEPS 100
 #define FREQUENCY_STEP_SIZE (FREQUENCY_MAX-FREQUENCY_MIN)/FREQUENCY_STEPS 
-#define MEAN_MIN 1.0
-#define MEAN_MAX 10.0
+#define MEAN_MIN WG_MEAN_MIN
+#define MEAN_MAX WG_MEAN_MAX
 #define MEAN_STEPS 100
 #define MEAN_STEP_SIZE (MEAN_MAX-MEAN_MIN)/MEAN_STEPS 
-#define AMPLITUDE_MIN 0
-#define AMPLITUDE_MAX 4095
+#define AMPLITUDE_MIN WG_AMPLITUDE_MIN
+#define AMPLITUDE_MAX WG_AMPLITUDE_MAX
 #define AMPLITUDE_STEPS 100
 #define AMPLITUDE_STEP_SIZE (AMPLITUDE_MAX-AMPLITUDE_MIN)/AMPLITUDE_STEPS 
 
+#define KEY_BATCH_MAX 64                            // Keys folded into one parameter update at most
+#define KEY_REPEAT_GAP_NS 150000000                 // Same key again within this is treated as held
+#define KEY_ACCEL_INTERVAL_NS 500000000             // Step size doubles every interval a key is held
+#define KEY_ACCEL_MAX_SHIFT 3                       // Up to 8 steps per key
+
+// Net change of one batch of keys, in steps
+struct key_batch {
+    int amplitude;
+    int frequency;
+    int mean;
+    int waveform;
+    bool exit;
+};
+
 float frequency;
 float mean;
 unsigned int amplitude;
-char* waveform_options[] = {"sine", "square", "triangular", "sawtooth"};
+char* waveform_options[] = {"sine", "square", "sawtooth", "triangular"};      // Same order as the engine library
 int current_waveform = -1;
 const unsigned int len_waveform = sizeof(waveform_options)/sizeof(waveform_options[0]);
 
@@ -45,20 +63,11 @@ bool convertNum(char* input, void* var_pointer, int format, float min, float max
 int promptInt(char* msg, int min, int max);
 float promptFloat(char* msg, float min, float max);
 void* get_keyboard_input();
+void read_key_batch(struct key_batch* batch);
+int key_steps(int ch);
 void constrain(void* var_pointer, float min, float max, int format);
 void print_keyboard_usage();
 
-void* shutdown() {
-    // For demonstration of shutdown of all threads using conditional variable
-    sleep(10);
-    
-    // Signal main thread to shutdown all threads and exit program
-    pthread_mutex_lock(&shutdown_mutex);
-    pthread_cond_signal(&shutdown_cond);
-    pthread_mutex_unlock(&shutdown_mutex);
-    pthread_exit(NULL);
-}
-
 int main(int argc, char **argv)
 {
     int opt;
@@ -149,9 +158,8 @@ int main(int argc, char **argv)
     noecho();
 
     print_keyboard_usage();
-    pthread_t kb_thread, shutdown_thread;
+    pthread_t kb_thread;
     pthread_create( &kb_thread, NULL, get_keyboard_input, NULL);
-    pthread_create( &shutdown_thread, NULL, shutdown, NULL);
 
     // Wait for shutdown condition
     pthread_mutex_lock(&shutdown_mutex);
@@ -160,7 +168,6 @@ int main(int argc, char **argv)
 
     // Shutdown all threads
     pthread_cancel(kb_thread); 
-    pthread_cancel(shutdown_thread);
 
     endwin();
     printf("Ending Program.\n");
@@ -173,7 +180,7 @@ void usage(char* progname) {
 	printf("[-f frequency]: (float) Frequency of wave (Hz). Range: %f - %f\n", FREQUENCY_MIN, FREQUENCY_MAX);
 	printf("[-m mean]: (float) Prescaled mean of wave. Range: %f - %f\n", MEAN_MIN, MEAN_MAX);
 	printf("[-a amplitude]: (unsigned int) Amplitude of wave. Range: %d - %d\n", AMPLITUDE_MIN, AMPLITUDE_MAX);
-    printf("[-w waveform]: (string) Type of waveform. Options: sine, square, triangular, sawtooth.\n");
+    printf("[-w waveform]: (string) Type of waveform. Options: sine, square, sawtooth, triangular.\n");
     printf("[-h]: Display this information..\n");
     exit(EXIT_FAILURE);
 }
@@ -223,49 +230,24 @@ bool convertNum(char* input, void* var_pointer, int format, float min, float max
     Returns:
         true when input is in correct format, else false
     */
-    char format_type[20] = "";
-    char c;
-    
-    if (format == INTEGER) {
-        int temp;
-        int* var_pointer_2 = (int*)var_pointer;
-        sprintf(format_type, "integer");
-        if (sscanf(input, "%d %c", &temp, &c) == 1) {
-            if (temp < (int) min) {
-                printf("%s is less than minimum number %d\n\n", input, (int) min);
-                return false;
-            }
-            else if (temp > (int) max) {
-                printf("%s is greater than maximum number %d\n\n", input, (int) max);
-                return false;
-            }
-            *var_pointer_2 = temp;
-            return true;
-        }
-    }
-    else if (format == FLOAT) {
-        float temp;
-        float* var_pointer_2 = (float*)var_pointer;
-        sprintf(format_type, "float");
-        if (sscanf(input, "%f %c", &temp, &c) == 1) {
-            if (temp < min) {
-                printf("%s is less than minimum number %f\n\n", input, min);
-                return false;
-            }
-            else if (temp > max) {
-                printf("%s is greater than maximum number %f\n\n", input, max);
-                return false;
-            }
-            *var_pointer_2 = temp;
-            return true;
-        }
-    }
-    else {
+    if (format != INTEGER && format != FLOAT) {
         printf("Unsupported format\n\n");
         return false;
     }
 
-    printf("Invalid format. %s is not %s\n\n", input, format_type);
+    switch (wg_parse_number(input, var_pointer, format, min, max)) {
+        case WG_OK:
+            return true;
+        case WG_ERR_BELOW:
+            if (format == INTEGER) printf("%s is less than minimum number %d\n\n", input, (int) min);
+            else printf("%s is less than minimum number %f\n\n", input, min);
+            return false;
+        case WG_ERR_ABOVE:
+            if (format == INTEGER) printf("%s is greater than maximum number %d\n\n", input, (int) max);
+            else printf("%s is greater than maximum number %f\n\n", input, max);
+            return false;
+    }
+    printf("Invalid format. %s is not %s\n\n", input, format == INTEGER ? "integer" : "float");
     return false;
 }
 
@@ -319,79 +301,133 @@ float promptFloat(char* msg, float min, float max) {
 }
 
 void* get_keyboard_input() {
-    int ch;
-    while((ch = getch()) != 'E') {
+    struct key_batch batch;
+
+    do {
+        // Fold everything typed since the last batch into one locked update and one repaint
+        read_key_batch(&batch);
+        if (batch.amplitude == 0 && batch.frequency == 0 && batch.mean == 0 && batch.waveform == 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&global_mutex);
+        if (batch.amplitude != 0) {
+            amplitude += batch.amplitude * AMPLITUDE_STEP_SIZE;
+            constrain(&amplitude, AMPLITUDE_MIN, AMPLITUDE_MAX, INTEGER);
+        }
+        if (batch.frequency != 0) {
+            frequency += batch.frequency * FREQUENCY_STEP_SIZE;
+            constrain(&frequency, FREQUENCY_MIN, FREQUENCY_MAX, FLOAT);
+        }
+        if (batch.mean != 0) {
+            mean += batch.mean * MEAN_STEP_SIZE;
+            constrain(&mean, MEAN_MIN, MEAN_MAX, FLOAT);
+        }
+        if (batch.waveform != 0) {
+            current_waveform += batch.waveform;
+            constrain(&current_waveform, 0, len_waveform-1, INTEGER);
+        }
+        pthread_mutex_unlock(&global_mutex);
+
         clear();
         print_keyboard_usage();
-        pthread_mutex_lock(&global_mutex);
+    } while (!batch.exit);
+
+    // Signal main thread to shutdown all threads and exit program
+    pthread_mutex_lock(&shutdown_mutex);
+    pthread_cond_signal(&shutdown_cond);
+    pthread_mutex_unlock(&shutdown_mutex);
+    pthread_exit(NULL);
+}
+
+void read_key_batch(struct key_batch* batch) {
+    /*
+    Blocks for one key, then drains whatever else is already queued without blocking
+    and folds it all into net steps per parameter. Keys after 'E' are ignored.
+
+    Parameters:
+        batch: net change of the keys read
+    */
+    int ch, count = 0;
+
+    memset(batch, 0, sizeof(*batch));
+    ch = getch();
+    nodelay(stdscr, TRUE);
+    while (ch != ERR) {
         switch(ch) {
             case KEY_UP:
-                amplitude += AMPLITUDE_STEP_SIZE;
+                batch->amplitude += key_steps(ch);
                 break;
             case KEY_DOWN:
-                amplitude -= AMPLITUDE_STEP_SIZE;
+                batch->amplitude -= key_steps(ch);
                 break;
             case KEY_RIGHT:
-                frequency += FREQUENCY_STEP_SIZE;
+                batch->frequency += key_steps(ch);
                 break;
             case KEY_LEFT:
-                frequency -= FREQUENCY_STEP_SIZE;
+                batch->frequency -= key_steps(ch);
                 break;
             case 'w':
             case 'W':
-                mean += MEAN_STEP_SIZE;
+                batch->mean += key_steps(ch);
                 break;
             case 's':
             case 'S':
-                mean -= MEAN_STEP_SIZE;
+                batch->mean -= key_steps(ch);
                 break;
             case 'a':
             case 'A':
-                current_waveform -= 1;
+                batch->waveform -= 1;
                 break;
             case 'd':
             case 'D':
-                current_waveform += 1;
+                batch->waveform += 1;
+                break;
+            case 'E':
+                batch->exit = true;
                 break;
-            // default:    
-            //     printw("\nThe pressed key is %c",ch);
         }
-        constrain(&frequency, FREQUENCY_MIN, FREQUENCY_MAX, FLOAT);
-        constrain(&mean, MEAN_MIN, MEAN_MAX, FLOAT);
-        constrain(&amplitude, AMPLITUDE_MIN, AMPLITUDE_MAX, INTEGER);
-        constrain(&current_waveform, 0, len_waveform-1, INTEGER);
-        pthread_mutex_unlock(&global_mutex);
+        if (batch->exit || ++count == KEY_BATCH_MAX) break;
+        ch = getch();
     }
+    nodelay(stdscr, FALSE);
+}
 
-    // Signal main thread to shutdown all threads and exit program
-    pthread_mutex_lock(&shutdown_mutex);
-    pthread_cond_signal(&shutdown_cond);
-    pthread_mutex_unlock(&shutdown_mutex);
-    pthread_exit(NULL);
+int key_steps(int ch) {
+    /*
+    Steps one press of ch is worth. Auto-repeat of a held key arrives as the same key in quick
+    succession, so the step size doubles every KEY_ACCEL_INTERVAL_NS the key has been held.
+
+    Parameters:
+        ch: key read
+
+    Returns:
+        number of steps, at least 1
+    */
+    static int held_key = ERR;
+    static uint64_t held_since, last_seen;
+    struct timespec ts;
+    uint64_t now, shift;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    if (ch != held_key || now - last_seen > KEY_REPEAT_GAP_NS) {
+        held_key = ch;
+        held_since = now;
+    }
+    last_seen = now;
+
+    shift = (now - held_since) / KEY_ACCEL_INTERVAL_NS;
+    if (shift > KEY_ACCEL_MAX_SHIFT) shift = KEY_ACCEL_MAX_SHIFT;
+    return 1 << shift;
 }
 
 void constrain(void* var_pointer, float min, float max, int format) {
-    if (format == INTEGER) {
-        int* var_pointer_2 = (int*)var_pointer;
-        if (*var_pointer_2 < (int) min) {
-            *var_pointer_2 = (int) min;
-        }
-        else if (*var_pointer_2 > (int) max) {
-            *var_pointer_2 = (int) max;
-        }
-    }
-    else if (format == FLOAT) {
-        float* var_pointer_2 = (float*)var_pointer;
-        if (*var_pointer_2 < min) {
-            *var_pointer_2 = min;
-        }
-        else if (*var_pointer_2 > max) {
-            *var_pointer_2 = max;
-        }
-    }
-    else {
+    if (format != INTEGER && format != FLOAT) {
         printf("Unsupported format\n\n");
+        return;
     }
+    wg_constrain(var_pointer, format, min, max);
 }
 
 void print_keyboard_usage() {
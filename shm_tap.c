@@ -0,0 +1,92 @@
+// Reader side of the shared-memory output tap, see shm_tap.h
+// Readers never write to the mapping, so any number can follow the generator without slowing it down
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "shm_tap.h"
+
+bool tap_open(struct tap_reader* reader, const char* name) {
+    /*
+    Maps the tap read-only and positions the reader at the newest complete block.
+
+    Parameters:
+        reader: reader state to initialise
+        name: shm_open() name the generator was started with
+
+    Returns:
+        true when the tap was mapped, else false
+    */
+    const struct tap_header* tap;
+    uint64_t head;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    if ((fd = shm_open(name, O_RDONLY, 0)) == -1) return false;
+    tap = mmap(NULL, sizeof(struct tap_header), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (tap == MAP_FAILED) return false;
+
+    if (__atomic_load_n(&tap->magic, __ATOMIC_ACQUIRE) != TAP_MAGIC || tap->version != TAP_VERSION) {
+        munmap((void*)tap, sizeof(struct tap_header));
+        return false;
+    }
+    head = __atomic_load_n(&tap->head, __ATOMIC_ACQUIRE);
+    reader->tap = tap;
+    reader->next = head > 0 ? head - 1 : 0;
+    return true;
+}
+
+int tap_read(struct tap_reader* reader, uint16_t* samples, uint64_t* first_sample) {
+    /*
+    Copies the next unread block. A reader that fell more than TAP_SLOTS blocks behind
+    skips to the oldest block still held and counts the rest in reader->lost.
+
+    Parameters:
+        reader: reader from tap_open()
+        samples: buffer of TAP_BLOCK_SAMPLES codes
+        first_sample: set to the output sample index of samples[0], may be NULL
+
+    Returns:
+        number of samples copied, 0 when no new block is ready
+    */
+    const struct tap_slot* slot;
+    uint64_t head, seq, expected;
+    uint32_t n;
+
+    while (1) {
+        head = __atomic_load_n(&reader->tap->head, __ATOMIC_ACQUIRE);
+        if (reader->next >= head) return 0;
+        if (head - reader->next > TAP_SLOTS) {
+            reader->lost += head - reader->next - TAP_SLOTS;
+            reader->next = head - TAP_SLOTS;
+        }
+
+        slot = &reader->tap->slot[reader->next & (TAP_SLOTS - 1)];
+        expected = 2 * (reader->next + 1);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == expected) {
+            n = slot->n;
+            if (n > TAP_BLOCK_SAMPLES) n = TAP_BLOCK_SAMPLES;
+            memcpy(samples, slot->samples, n * sizeof(uint16_t));
+            if (first_sample != NULL) *first_sample = slot->sample;
+
+            // Keep the copy only if the writer did not start reusing the slot meanwhile
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == expected) {
+                reader->next++;
+                return n;
+            }
+        }
+
+        // Slot already reused, the block is gone
+        reader->lost++;
+        reader->next++;
+    }
+}
+
+void tap_close(struct tap_reader* reader) {
+    if (reader->tap != NULL) munmap((void*)reader->tap, sizeof(struct tap_header));
+    reader->tap = NULL;
+}
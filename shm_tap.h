@@ -0,0 +1,50 @@
+// Shared-memory output tap: layout written by draft3.c (-o) and the reader library in shm_tap.c
+// cc -c shm_tap.c, link readers with shm_tap.o (add -lrt where shm_open is not in libc)
+
+#ifndef SHM_TAP_H
+#define SHM_TAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TAP_NAME "/wavegen_tap"                     // Default shm_open() name
+#define TAP_MAGIC 0x50415457                        // "WTAP" little-endian
+#define TAP_VERSION 1
+#define TAP_SLOTS 256                               // Blocks kept, power of two
+#define TAP_BLOCK_SAMPLES 32                        // Most samples per block
+
+// One block of DAC codes, guarded by seq: odd while the writer is filling the slot,
+// 2 * (block number + 1) once it is complete
+struct tap_slot {
+    uint64_t seq;
+    uint64_t sample;                                // Output sample index of samples[0]
+    uint32_t n;
+    uint32_t reserved;
+    uint16_t samples[TAP_BLOCK_SAMPLES];
+};
+
+struct tap_header {
+    uint32_t magic;                                 // Stored last by the writer, readers wait for it
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t slots;
+    uint64_t head;                                  // Blocks ever written
+    struct tap_slot slot[TAP_SLOTS];
+};
+
+struct tap_reader {
+    const struct tap_header* tap;                   // Read-only mapping
+    uint64_t next;                                  // Block number to read next
+    uint64_t lost;                                  // Blocks overwritten before they were read
+};
+
+// Maps the tap read-only and starts at the newest block, false if it does not exist or is not a tap
+bool tap_open(struct tap_reader* reader, const char* name);
+
+// Copies the next block into samples (TAP_BLOCK_SAMPLES long), returns its length or 0 when none is new
+int tap_read(struct tap_reader* reader, uint16_t* samples, uint64_t* first_sample);
+
+void tap_close(struct tap_reader* reader);
+
+#endif
@@ -0,0 +1,65 @@
+// cc -o tap_reader tap_reader.c shm_tap.c
+// Follows the generator's shared-memory tap and prints one line per second of output, or every sample with -v
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shm_tap.h"
+
+#define POLL_US 5000
+
+int main(int argc, char* argv[]) {
+    struct tap_reader reader;
+    uint16_t samples[TAP_BLOCK_SAMPLES];
+    uint64_t first, report = 0;
+    char* name = TAP_NAME;
+    bool verbose = false;
+    unsigned long count = 0;
+    uint16_t low = UINT16_MAX, high = 0;
+    int opt, n, k;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt == 'v') {
+            verbose = true;
+        }
+        else {
+            printf("Usage: %s [-v] [tap_name]\n", argv[0]);
+            printf("tap_name defaults to %s, as with draft -o %s\n", TAP_NAME, TAP_NAME);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) name = argv[optind];
+
+    if (!tap_open(&reader, name)) {
+        perror(name);
+        return EXIT_FAILURE;
+    }
+    printf("Following %s at %u Hz\n", name, reader.tap->sample_rate);
+
+    while (true) {
+        if ((n = tap_read(&reader, samples, &first)) == 0) {
+            usleep(POLL_US);
+            continue;
+        }
+        for (k = 0; k < n; k++) {
+            if (verbose) printf("%llu %u\n", (unsigned long long)(first + k), samples[k]);
+            if (samples[k] < low) low = samples[k];
+            if (samples[k] > high) high = samples[k];
+        }
+        count += n;
+
+        if (!verbose && first + n >= report) {
+            printf("sample %llu: %lu samples, range %u - %u, %llu blocks lost\n",
+                   (unsigned long long)(first + n), count, low, high, (unsigned long long)reader.lost);
+            fflush(stdout);
+            report = first + n + reader.tap->sample_rate;
+            count = 0;
+            low = UINT16_MAX;
+            high = 0;
+        }
+    }
+    tap_close(&reader);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+// Binary trace file layout written by draft3.c (-x) and read by trace2json.c
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x43525457                      // "WTRC" little-endian
+#define TRACE_VERSION 1
+#define TRACE_NAME_SIZE 16
+
+// Event types
+#define TRACE_BLOCK 1                               // Block rendered, arg: render time (ns)
+#define TRACE_DAC_WRITE 2                           // Sample written to the DAC, arg: DAC code
+#define TRACE_PARAM_CHANGE 3                        // Parameters changed, arg: parameter version
+#define TRACE_LOCK_WAIT 4                           // global_mutex acquired, arg: time spent waiting (ns)
+#define TRACE_DEADLINE_MISS 5                       // Woke after the sample deadline, arg: lateness (ns)
+#define TRACE_UI_REFRESH 6                          // Screen redrawn, arg: draw time (ns)
+
+struct trace_event {
+    uint64_t time;                                  // CLOCK_MONOTONIC (ns), start of the event for spans
+    uint32_t type;
+    uint32_t arg;
+};
+
+// File is one trace_file_header, then per thread a trace_thread_header followed by its events oldest first
+struct trace_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_threads;
+    uint32_t reserved;
+};
+
+struct trace_thread_header {
+    char name[TRACE_NAME_SIZE];
+    uint32_t tid;
+    uint32_t num_events;
+    uint64_t dropped;                               // Events overwritten in the ring before the dump
+};
+
+#endif
@@ -0,0 +1,143 @@
+// cc -o trace2json trace2json.c
+// Converts a draft3.c trace dump (-x) to Chrome trace JSON, open with chrome://tracing or ui.perfetto.dev
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+// Function Prototypes
+bool convert(FILE* in, FILE* out);
+void write_event(FILE* out, uint32_t tid, const struct trace_event* event, uint64_t origin);
+
+int main(int argc, char* argv[]) {
+    FILE* in;
+    FILE* out = stdout;
+    bool ok;
+
+    if (argc < 2 || argc > 3) {
+        printf("Usage: %s trace_file [json_file]\n", argv[0]);
+        printf("Writes to stdout when json_file is omitted.\n");
+        return EXIT_FAILURE;
+    }
+    if ((in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 3 && (out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    ok = convert(in, out);
+    fclose(in);
+    if (out != stdout) fclose(out);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool convert(FILE* in, FILE* out) {
+    /*
+    Reads every thread section of a trace file and writes one JSON event per trace event.
+    Timestamps are made relative to the earliest event across all threads.
+
+    Parameters:
+        in: trace file, opened for binary reading
+        out: destination for the JSON
+
+    Returns:
+        true when the whole file was converted, else false
+    */
+    struct trace_file_header header;
+    struct trace_thread_header thread;
+    struct trace_event event;
+    long sections;
+    uint64_t origin = UINT64_MAX;
+    uint32_t t, k;
+    bool first = true;
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC) {
+        fprintf(stderr, "Not a trace file\n");
+        return false;
+    }
+    if (header.version != TRACE_VERSION) {
+        fprintf(stderr, "Trace version %u, expected %u\n", header.version, TRACE_VERSION);
+        return false;
+    }
+
+    // First pass for the origin over every event, spans are recorded when they end but stamped with their start
+    sections = ftell(in);
+    for (t = 0; t < header.num_threads; t++) {
+        if (fread(&thread, sizeof(thread), 1, in) != 1) {
+            fprintf(stderr, "Truncated trace file\n");
+            return false;
+        }
+        for (k = 0; k < thread.num_events; k++) {
+            if (fread(&event, sizeof(event), 1, in) != 1) {
+                fprintf(stderr, "Truncated trace file\n");
+                return false;
+            }
+            if (event.time < origin) origin = event.time;
+        }
+    }
+    fseek(in, sections, SEEK_SET);
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (t = 0; t < header.num_threads; t++) {
+        if (fread(&thread, sizeof(thread), 1, in) != 1) {
+            fprintf(stderr, "Truncated trace file\n");
+            return false;
+        }
+        thread.name[TRACE_NAME_SIZE - 1] = '\0';
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", thread.tid, thread.name);
+        first = false;
+        if (thread.dropped > 0) {
+            fprintf(stderr, "%s: %llu older events were overwritten\n", thread.name, (unsigned long long)thread.dropped);
+        }
+
+        for (k = 0; k < thread.num_events; k++) {
+            if (fread(&event, sizeof(event), 1, in) != 1) {
+                fprintf(stderr, "Truncated trace file\n");
+                return false;
+            }
+            write_event(out, thread.tid, &event, origin);
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return true;
+}
+
+void write_event(FILE* out, uint32_t tid, const struct trace_event* event, uint64_t origin) {
+    // Spans become complete ("X") events, the DAC code a counter track, the rest instants
+    double ts = (event->time - origin) / 1000.0;
+
+    switch (event->type) {
+        case TRACE_BLOCK:
+            fprintf(out, ",\n{\"name\":\"render block\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    tid, ts, event->arg / 1000.0);
+            break;
+        case TRACE_DAC_WRITE:
+            fprintf(out, ",\n{\"name\":\"dac\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"code\":%u}}",
+                    tid, ts, event->arg);
+            break;
+        case TRACE_PARAM_CHANGE:
+            fprintf(out, ",\n{\"name\":\"parameter change\",\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"version\":%u}}",
+                    tid, ts, event->arg);
+            break;
+        case TRACE_LOCK_WAIT:
+            fprintf(out, ",\n{\"name\":\"lock wait\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    tid, ts, event->arg / 1000.0);
+            break;
+        case TRACE_DEADLINE_MISS:
+            fprintf(out, ",\n{\"name\":\"deadline miss\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"late_us\":%.3f}}",
+                    tid, ts, event->arg / 1000.0);
+            break;
+        case TRACE_UI_REFRESH:
+            fprintf(out, ",\n{\"name\":\"ui refresh\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    tid, ts, event->arg / 1000.0);
+            break;
+        default:
+            fprintf(stderr, "Skipping unknown event type %u\n", event->type);
+    }
+}
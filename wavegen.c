@@ -0,0 +1,529 @@
+// Generator engine library, see wavegen.h for the API and build lines
+// Parameters cross threads through a seqlock: writers take it with a compare-and-swap, the render
+// thread never waits for it and keeps the previous parameters for one block when it loses a race.
+
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "wavegen.h"
+
+#define WG_TABLES_MAGIC 0x42544757                  // "WGTB" little-endian
+#define WG_ENGINE_MAGIC 0x4E454757                  // "WGEN" little-endian
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct wg_tables {
+    uint32_t magic;
+    const float* table[WG_NUM_TABLES];              // Into data, or into a mapped file
+    float data[WG_NUM_TABLES][WG_TABLE_SIZE];       // Computed tables, absent when mapped
+};
+
+struct wg_engine {
+    uint32_t magic;
+    const struct wg_tables* tables;
+    unsigned int sample_rate;
+
+    // Written by any thread under the seqlock: seq is odd while a writer is storing params
+    uint64_t seq;
+    struct wg_params params;
+
+    // Render thread only
+    uint64_t loaded_seq;                            // seq the derived state below was computed from
+    struct wg_params current;
+    const float* table;                             // NULL for the triangular shape, computed directly
+    double phase;                                   // Cycles [0, 1)
+    double phase_inc;
+    struct wg_stats stats;                          // updates and writer_retries are added atomically by writers
+};
+
+// Internal Functions
+static bool check_params(const struct wg_params* params, int* status);
+static void load_params(struct wg_engine* engine);
+static void advance(struct timespec* t, long ns);
+
+size_t wg_tables_size(void) {
+    return sizeof(struct wg_tables);
+}
+
+struct wg_tables* wg_tables_init(void* memory, size_t size) {
+    /*
+    Computes one period of every table: sine, square, sawtooth and triangular, then WG_OCTAVES
+    band-limited levels each of square and sawtooth. Each level adds the next octave of harmonics
+    to the previous one.
+
+    Parameters:
+        memory: at least wg_tables_size() bytes, aligned as malloc() would align them
+        size: size of memory
+
+    Returns:
+        the tables, or NULL when memory is too small or misaligned
+    */
+    struct wg_tables* tables = memory;
+    double square_sum[WG_TABLE_SIZE];
+    double sawtooth_sum[WG_TABLE_SIZE];
+    double x;
+    int t, n, h, level;
+
+    if (memory == NULL || size < sizeof(struct wg_tables) ||
+        (uintptr_t)memory % __alignof__(struct wg_tables) != 0) {
+        return NULL;
+    }
+
+    for (n = 0; n < WG_TABLE_SIZE; n++) {
+        x = 2 * M_PI * n / WG_TABLE_SIZE;
+        tables->data[WG_SINE][n] = sin(x);
+        tables->data[WG_SQUARE][n] = (n < WG_TABLE_SIZE/2) ? -1.0 : 1.0;
+        tables->data[WG_SAWTOOTH][n] = -1.0 + ((double)n)/((double)(WG_TABLE_SIZE-1)) * 2.0;
+        tables->data[WG_TRIANGULAR][n] = asin(sin(x)) * 2 / M_PI;
+    }
+
+    memset(square_sum, 0, sizeof(square_sum));
+    memset(sawtooth_sum, 0, sizeof(sawtooth_sum));
+    for (level = 0, h = 1; level < WG_OCTAVES; level++) {
+        for (; h <= (1 << level); h++) {
+            for (n = 0; n < WG_TABLE_SIZE; n++) {
+                x = sin(2 * M_PI * h * n / WG_TABLE_SIZE) / h;
+                if (h % 2) square_sum[n] -= 4 / M_PI * x;
+                sawtooth_sum[n] -= 2 / M_PI * x;
+            }
+        }
+        for (n = 0; n < WG_TABLE_SIZE; n++) {
+            tables->data[WG_TABLE_SQUARE_BL + level][n] = square_sum[n];
+            tables->data[WG_TABLE_SAWTOOTH_BL + level][n] = sawtooth_sum[n];
+        }
+    }
+    for (t = 0; t < WG_NUM_TABLES; t++) {
+        tables->table[t] = tables->data[t];
+    }
+    tables->magic = WG_TABLES_MAGIC;
+    return tables;
+}
+
+const float* wg_table(const struct wg_tables* tables, int t) {
+    // Table t of WG_NUM_TABLES, one period of WG_TABLE_SIZE samples
+    return tables->table[t];
+}
+
+int wg_bandlimited_level(double frequency, double sample_rate) {
+    // Richest band-limited level whose top harmonic stays below Nyquist, the richest of all at 0 Hz
+    double max_harmonic;
+    int level;
+
+    if (frequency <= 0) return WG_OCTAVES - 1;
+    max_harmonic = sample_rate / 2.0 / frequency;
+    for (level = 0; level < WG_OCTAVES - 1 && (1 << (level + 1)) <= max_harmonic; level++);
+    return level;
+}
+
+int wg_tables_write(const struct wg_tables* tables, const char* path) {
+    /*
+    Writes the tables to a wavetable file for wg_tables_map().
+    The file is written under a temporary name and renamed into place, so concurrent processes never map a partial file.
+
+    Parameters:
+        tables: tables to write
+        path: wavetable file to create or replace
+
+    Returns:
+        WG_OK, or WG_ERR_FILE with errno set by the call that failed
+    */
+    struct wg_file_header header;
+    char tmp_path[256];
+    FILE* fp;
+    int t;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = WG_FILE_MAGIC;
+    header.version = WG_FILE_VERSION;
+    header.table_size = WG_TABLE_SIZE;
+    header.num_tables = WG_NUM_TABLES;
+    for (t = 0; t < WG_NUM_TABLES; t++) {
+        header.table_offset[t] = sizeof(header) + t * WG_TABLE_SIZE * sizeof(float);
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    if ((fp = fopen(tmp_path, "wb")) == NULL) return WG_ERR_FILE;
+    fwrite(&header, sizeof(header), 1, fp);
+    for (t = 0; t < WG_NUM_TABLES; t++) {
+        fwrite(tables->table[t], sizeof(float), WG_TABLE_SIZE, fp);
+    }
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return WG_ERR_FILE;
+    }
+    return WG_OK;
+}
+
+size_t wg_tables_map_size(void) {
+    return offsetof(struct wg_tables, data);
+}
+
+struct wg_tables* wg_tables_map(void* memory, size_t size, const void* file, size_t file_size) {
+    /*
+    Points tables at the contents of a wavetable file, which must stay mapped as long as the tables are used.
+    Files from other versions are rejected so the caller can regenerate them.
+
+    Parameters:
+        memory: at least wg_tables_map_size() bytes, aligned as malloc() would align them
+        size: size of memory
+        file: whole wavetable file
+        file_size: size of file
+
+    Returns:
+        the tables, or NULL when memory is unusable or the file is not in the current format
+    */
+    struct wg_tables* tables = memory;
+    const struct wg_file_header* header = file;
+    int t;
+
+    if (memory == NULL || size < wg_tables_map_size() ||
+        (uintptr_t)memory % __alignof__(struct wg_tables) != 0) {
+        return NULL;
+    }
+    if (file == NULL || file_size < sizeof(struct wg_file_header) ||
+        header->magic != WG_FILE_MAGIC || header->version != WG_FILE_VERSION ||
+        header->table_size != WG_TABLE_SIZE || header->num_tables < WG_NUM_TABLES ||
+        header->num_tables > WG_FILE_MAX_TABLES) {
+        return NULL;
+    }
+    for (t = 0; t < WG_NUM_TABLES; t++) {
+        if (header->table_offset[t] % sizeof(float) != 0 ||
+            header->table_offset[t] + WG_TABLE_SIZE * sizeof(float) > file_size) {
+            return NULL;
+        }
+        tables->table[t] = (const float*)((const char*)file + header->table_offset[t]);
+    }
+    tables->magic = WG_TABLES_MAGIC;
+    return tables;
+}
+
+size_t wg_engine_size(void) {
+    return sizeof(struct wg_engine);
+}
+
+struct wg_engine* wg_engine_init(void* memory, size_t size, const struct wg_tables* tables,
+                                 unsigned int sample_rate, const struct wg_params* params) {
+    /*
+    Sets up one generator in caller-provided memory. Nothing is allocated, now or later.
+
+    Parameters:
+        memory: at least wg_engine_size() bytes, aligned as malloc() would align them
+        size: size of memory
+        tables: from wg_tables_init(), must outlive the engine
+        sample_rate: output samples per second, at least WG_SAMPLE_RATE_MIN so a sample never advances a whole period
+        params: initial parameters
+
+    Returns:
+        the engine, or NULL when memory is unusable, tables are not initialised, sample_rate is too low
+        or params are out of range
+    */
+    struct wg_engine* engine = memory;
+    int status;
+
+    if (memory == NULL || size < sizeof(struct wg_engine) ||
+        (uintptr_t)memory % __alignof__(struct wg_engine) != 0) {
+        return NULL;
+    }
+    if (tables == NULL || tables->magic != WG_TABLES_MAGIC || sample_rate < WG_SAMPLE_RATE_MIN) return NULL;
+    if (!check_params(params, &status)) return NULL;
+
+    memset(engine, 0, sizeof(*engine));
+    engine->tables = tables;
+    engine->sample_rate = sample_rate;
+    engine->params = *params;
+    engine->seq = 2;
+    engine->loaded_seq = 0;
+    engine->magic = WG_ENGINE_MAGIC;
+    load_params(engine);
+    return engine;
+}
+
+int64_t wg_set_params(struct wg_engine* engine, const struct wg_params* params) {
+    /*
+    Publishes new parameters. Safe from any number of threads at once, concurrent writers spin
+    on the sequence counter for the few stores another writer is making.
+
+    Parameters:
+        engine: engine to update
+        params: parameters to render from the next block on
+
+    Returns:
+        version the render thread reports through wg_rendered_version() once it uses them,
+        or WG_ERR_BELOW / WG_ERR_ABOVE / WG_ERR_WAVEFORM when a parameter is out of range
+    */
+    uint64_t seq;
+    int status;
+
+    if (!check_params(params, &status)) return status;
+
+    seq = __atomic_load_n(&engine->seq, __ATOMIC_RELAXED);
+    while ((seq & 1) || !__atomic_compare_exchange_n(&engine->seq, &seq, seq + 1, false,
+                                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&engine->stats.writer_retries, 1, __ATOMIC_RELAXED);
+        seq = __atomic_load_n(&engine->seq, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&engine->params.frequency, &params->frequency, __ATOMIC_RELAXED);
+    __atomic_store(&engine->params.mean, &params->mean, __ATOMIC_RELAXED);
+    __atomic_store_n(&engine->params.amplitude, params->amplitude, __ATOMIC_RELAXED);
+    __atomic_store_n(&engine->params.waveform, params->waveform, __ATOMIC_RELAXED);
+    __atomic_store_n(&engine->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&engine->stats.updates, 1, __ATOMIC_RELAXED);
+    return (int64_t)((seq + 2) / 2);
+}
+
+void wg_get_params(struct wg_engine* engine, struct wg_params* params) {
+    // Latest published parameters, waits out a writer in progress
+    uint64_t seq;
+
+    do {
+        while ((seq = __atomic_load_n(&engine->seq, __ATOMIC_ACQUIRE)) & 1);
+        __atomic_load(&engine->params.frequency, &params->frequency, __ATOMIC_RELAXED);
+        __atomic_load(&engine->params.mean, &params->mean, __ATOMIC_RELAXED);
+        params->amplitude = __atomic_load_n(&engine->params.amplitude, __ATOMIC_RELAXED);
+        params->waveform = __atomic_load_n(&engine->params.waveform, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&engine->seq, __ATOMIC_RELAXED) != seq);
+}
+
+void wg_render(struct wg_engine* engine, unsigned int* codes, int n) {
+    /*
+    Renders n DAC codes, (shape + mean) * amplitude clamped at zero, with tables read through WG_READ_LERP().
+
+    Parameters:
+        engine: engine owned by the calling thread
+        codes: buffer of n codes
+        n: number of samples
+    */
+    const float* table;
+    double phase, phase_inc, offset, gain, v;
+    int k;
+
+    load_params(engine);
+    table = engine->table;
+    phase = engine->phase;
+    phase_inc = engine->phase_inc;
+    offset = engine->current.mean;
+    gain = engine->current.amplitude;
+    for (k = 0; k < n; k++) {
+        v = table != NULL ? WG_READ_LERP(table, WG_TABLE_SIZE, phase) : WG_TRIANGULAR_SHAPE(phase);
+        v = (v + offset) * gain;
+        codes[k] = v > 0.0 ? (unsigned int)v : 0;
+        phase += phase_inc;
+        if (phase >= 1.0) phase -= 1.0;
+    }
+    engine->phase = phase;
+    engine->stats.blocks++;
+    engine->stats.samples += n;
+}
+
+void wg_render_float(struct wg_engine* engine, float* out, int n) {
+    // Same as wg_render() without the clamp or the conversion to codes
+    const float* table;
+    double phase, phase_inc, offset, gain, v;
+    int k;
+
+    load_params(engine);
+    table = engine->table;
+    phase = engine->phase;
+    phase_inc = engine->phase_inc;
+    offset = engine->current.mean;
+    gain = engine->current.amplitude;
+    for (k = 0; k < n; k++) {
+        v = table != NULL ? WG_READ_LERP(table, WG_TABLE_SIZE, phase) : WG_TRIANGULAR_SHAPE(phase);
+        out[k] = (float)((v + offset) * gain);
+        phase += phase_inc;
+        if (phase >= 1.0) phase -= 1.0;
+    }
+    engine->phase = phase;
+    engine->stats.blocks++;
+    engine->stats.samples += n;
+}
+
+uint64_t wg_rendered_version(const struct wg_engine* engine) {
+    // Parameter version of the last rendered block, compare with the value wg_set_params() returned
+    return __atomic_load_n(&engine->loaded_seq, __ATOMIC_ACQUIRE) / 2;
+}
+
+void wg_output(struct wg_engine* engine, wg_write_fn write, void* user, const volatile bool* running) {
+    /*
+    Output pipeline: renders WG_BLOCK_SIZE samples a block ahead and hands each to write at its
+    absolute deadline, so the rate does not drift with render or write time.
+
+    Parameters:
+        engine: engine owned by the calling thread
+        write: called with each DAC code
+        user: passed to write
+        running: checked once per block, output stops when it becomes false
+    */
+    unsigned int block[WG_BLOCK_SIZE];
+    struct timespec deadline, now;
+    long period_ns = 1000000000L / engine->sample_rate;
+    int64_t late;
+    int k;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (*running) {
+        wg_render(engine, block, WG_BLOCK_SIZE);
+        for (k = 0; k < WG_BLOCK_SIZE; k++) {
+            advance(&deadline, period_ns);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+            write(user, block[k]);
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            late = (int64_t)(now.tv_sec - deadline.tv_sec) * 1000000000 + (now.tv_nsec - deadline.tv_nsec);
+            if (late > period_ns) engine->stats.late_by_period++;
+            if (late > 0 && (uint64_t)late > engine->stats.late_max_ns) engine->stats.late_max_ns = late;
+        }
+    }
+}
+
+void wg_get_stats(const struct wg_engine* engine, struct wg_stats* stats) {
+    stats->blocks = __atomic_load_n(&engine->stats.blocks, __ATOMIC_RELAXED);
+    stats->samples = __atomic_load_n(&engine->stats.samples, __ATOMIC_RELAXED);
+    stats->updates = __atomic_load_n(&engine->stats.updates, __ATOMIC_RELAXED);
+    stats->writer_retries = __atomic_load_n(&engine->stats.writer_retries, __ATOMIC_RELAXED);
+    stats->reader_retries = __atomic_load_n(&engine->stats.reader_retries, __ATOMIC_RELAXED);
+    stats->late_by_period = __atomic_load_n(&engine->stats.late_by_period, __ATOMIC_RELAXED);
+    stats->late_max_ns = __atomic_load_n(&engine->stats.late_max_ns, __ATOMIC_RELAXED);
+}
+
+int wg_parse_number(const char* text, void* value, int format, float min, float max) {
+    /*
+    Converts text to an int (WG_INTEGER) or float (WG_FLOAT) and stores it when it is within [min, max].
+    Trailing characters other than whitespace, and nan or inf, make the text invalid.
+
+    Parameters:
+        text: number to convert
+        value: int or float to store the result in
+        format: WG_INTEGER or WG_FLOAT
+        min: minimum value to accept
+        max: maximum value to accept
+
+    Returns:
+        WG_OK, WG_ERR_FORMAT, WG_ERR_BELOW or WG_ERR_ABOVE
+    */
+    int int_value;
+    float float_value;
+    char c;
+
+    if (format == WG_INTEGER) {
+        if (sscanf(text, "%d %c", &int_value, &c) != 1) return WG_ERR_FORMAT;
+        if (int_value < (int)min) return WG_ERR_BELOW;
+        if (int_value > (int)max) return WG_ERR_ABOVE;
+        *(int*)value = int_value;
+        return WG_OK;
+    }
+    if (format == WG_FLOAT) {
+        if (sscanf(text, "%f %c", &float_value, &c) != 1 || !isfinite(float_value)) return WG_ERR_FORMAT;
+        if (float_value < min) return WG_ERR_BELOW;
+        if (float_value > max) return WG_ERR_ABOVE;
+        *(float*)value = float_value;
+        return WG_OK;
+    }
+    return WG_ERR_FORMAT;
+}
+
+void wg_constrain(void* value, int format, float min, float max) {
+    // Clamps an int (WG_INTEGER) or float (WG_FLOAT) into [min, max]
+    int* int_value = value;
+    float* float_value = value;
+
+    if (format == WG_INTEGER) {
+        if (*int_value < (int)min) *int_value = (int)min;
+        else if (*int_value > (int)max) *int_value = (int)max;
+    }
+    else if (format == WG_FLOAT) {
+        if (*float_value < min) *float_value = min;
+        else if (*float_value > max) *float_value = max;
+    }
+}
+
+int wg_waveform_from_name(const char* name) {
+    // Case-insensitive match against wg_waveform_name(), WG_ERR_WAVEFORM when unknown
+    const char* option;
+    int k, i;
+
+    for (k = 0; k < WG_NUM_WAVEFORMS; k++) {
+        option = wg_waveform_name(k);
+        for (i = 0; option[i] != '\0' && tolower((unsigned char)name[i]) == option[i]; i++);
+        if (option[i] == '\0' && name[i] == '\0') return k;
+    }
+    return WG_ERR_WAVEFORM;
+}
+
+const char* wg_waveform_name(int waveform) {
+    static const char* names[WG_NUM_WAVEFORMS] = {"sine", "square", "sawtooth", "triangular"};
+
+    if (waveform < 0 || waveform >= WG_NUM_WAVEFORMS) return "unknown";
+    return names[waveform];
+}
+
+static bool check_params(const struct wg_params* params, int* status) {
+    // Range check shared by init and updates, the amplitude is unsigned so only its maximum can fail
+    *status = WG_OK;
+    if (!isfinite(params->frequency) || !isfinite(params->mean)) *status = WG_ERR_FORMAT;
+    else if (params->frequency < WG_FREQUENCY_MIN || params->mean < WG_MEAN_MIN) *status = WG_ERR_BELOW;
+    else if (params->frequency > WG_FREQUENCY_MAX || params->mean > WG_MEAN_MAX ||
+             params->amplitude > WG_AMPLITUDE_MAX) *status = WG_ERR_ABOVE;
+    else if (params->waveform < 0 || params->waveform >= WG_NUM_WAVEFORMS) *status = WG_ERR_WAVEFORM;
+    return *status == WG_OK;
+}
+
+static void load_params(struct wg_engine* engine) {
+    /*
+    Picks up published parameters at the start of a block. Never waits: if a writer is mid-update
+    or the copy was torn, the block is rendered with the previous parameters and the change is
+    taken on the next one.
+    */
+    struct wg_params params;
+    uint64_t seq = __atomic_load_n(&engine->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == engine->loaded_seq) return;
+    if (seq & 1) {
+        engine->stats.reader_retries++;
+        return;
+    }
+    __atomic_load(&engine->params.frequency, &params.frequency, __ATOMIC_RELAXED);
+    __atomic_load(&engine->params.mean, &params.mean, __ATOMIC_RELAXED);
+    params.amplitude = __atomic_load_n(&engine->params.amplitude, __ATOMIC_RELAXED);
+    params.waveform = __atomic_load_n(&engine->params.waveform, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&engine->seq, __ATOMIC_RELAXED) != seq) {
+        engine->stats.reader_retries++;
+        return;
+    }
+
+    engine->current = params;
+    engine->phase_inc = params.frequency / engine->sample_rate;
+    switch (params.waveform) {
+        case WG_SINE:
+            engine->table = engine->tables->table[WG_SINE];
+            break;
+        case WG_SQUARE:
+            engine->table = engine->tables->table[WG_TABLE_SQUARE_BL +
+                                                  wg_bandlimited_level(params.frequency, engine->sample_rate)];
+            break;
+        case WG_SAWTOOTH:
+            engine->table = engine->tables->table[WG_TABLE_SAWTOOTH_BL +
+                                                  wg_bandlimited_level(params.frequency, engine->sample_rate)];
+            break;
+        default:
+            engine->table = NULL;
+    }
+    __atomic_store_n(&engine->loaded_seq, seq, __ATOMIC_RELEASE);
+}
+
+static void advance(struct timespec* t, long ns) {
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000) {
+        t->tv_nsec -= 1000000000;
+        t->tv_sec++;
+    }
+}
@@ -0,0 +1,141 @@
+// Generator engine: synthesis and DAC output pipeline without the ncurses front end
+// Static:  cc -c wavegen.c && ar rcs libwavegen.a wavegen.o
+// Shared:  cc -shared -fPIC -o libwavegen.so wavegen.c -lm
+// Link:    cc -o app app.c libwavegen.a -lm
+//
+// The library never allocates. The caller provides memory for the shared tables and for each engine,
+// sized with wg_tables_size() and wg_engine_size() and aligned as malloc() would align it, so an engine
+// can live in a static buffer of a real-time harness. After wg_engine_init() no call takes a lock or
+// makes a system call except wg_output(), which sleeps until each sample's deadline.
+//
+// Tables are computed in place with wg_tables_init(), or read from a wavetable file the caller has mapped
+// with wg_tables_map(), so every process rendering from the file shares its pages.
+
+#ifndef WAVEGEN_H
+#define WAVEGEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Parameter ranges shared by every front end
+#define WG_FREQUENCY_MIN 0.0
+#define WG_FREQUENCY_MAX 100.0
+#define WG_MEAN_MIN 1.0
+#define WG_MEAN_MAX 10.0
+#define WG_AMPLITUDE_MIN 0
+#define WG_AMPLITUDE_MAX 65535
+#define WG_SAMPLE_RATE_MIN (2 * (unsigned int)WG_FREQUENCY_MAX)    // Lowest rate that still holds WG_FREQUENCY_MAX
+
+// Waveforms, in the order every front end lists them
+#define WG_SINE 0
+#define WG_SQUARE 1
+#define WG_SAWTOOTH 2
+#define WG_TRIANGULAR 3
+#define WG_NUM_WAVEFORMS 4
+
+#define WG_BLOCK_SIZE 32                            // Samples wg_output() renders per block
+#define WG_TABLE_SIZE 4096                          // Samples per table period, the phase resolution of table reads
+#define WG_OCTAVES 11                               // Band-limited levels, level k keeps harmonics up to 2^k
+
+// Tables, in wg_table() and wavetable file order. The plain shapes come first in waveform order
+#define WG_TABLE_SQUARE_BL 4                        // First band-limited square level
+#define WG_TABLE_SAWTOOTH_BL (WG_TABLE_SQUARE_BL + WG_OCTAVES)
+#define WG_NUM_TABLES (WG_TABLE_SAWTOOTH_BL + WG_OCTAVES)
+
+// Wavetable file written by wg_tables_write()
+#define WG_FILE_MAGIC 0x4C425457                    // "WTBL"
+#define WG_FILE_VERSION 2
+#define WG_FILE_MAX_TABLES 64
+
+// Table reads at phase p in cycles [0, 1), shared by wg_render() and the callers' own kernels.
+// size must be a power of two
+#define WG_READ_NEAREST(table, size, p) ((table)[(int)((p) * (size))])
+#define WG_READ_LERP(table, size, p) \
+    ((table)[(int)((p) * (size))] + ((p) * (size) - (int)((p) * (size))) * \
+     ((table)[((int)((p) * (size)) + 1) & ((size) - 1)] - (table)[(int)((p) * (size))]))
+#define WG_TRIANGULAR_SHAPE(p) ((p) < 0.25 ? 4 * (p) : (p) < 0.75 ? 2 - 4 * (p) : 4 * (p) - 4)
+
+// Number formats for wg_parse_number() and wg_constrain()
+#define WG_INTEGER 0
+#define WG_FLOAT 1
+
+// Status codes
+#define WG_OK 0
+#define WG_ERR_FORMAT -1                            // Not a finite number of the requested format
+#define WG_ERR_BELOW -2                             // Less than the minimum
+#define WG_ERR_ABOVE -3                             // Greater than the maximum
+#define WG_ERR_WAVEFORM -4                          // Unknown waveform
+#define WG_ERR_FILE -5                              // Wavetable file could not be written
+
+struct wg_params {
+    float frequency;                                // Hz
+    float mean;                                     // Prescaled mean, the output is (shape + mean) * amplitude
+    unsigned int amplitude;
+    int waveform;                                   // WG_SINE .. WG_TRIANGULAR
+};
+
+struct wg_stats {
+    uint64_t blocks;                                // wg_render() and wg_render_float() calls
+    uint64_t samples;
+    uint64_t updates;                               // Successful wg_set_params() calls
+    uint64_t writer_retries;                        // wg_set_params() spins while another writer held the parameters
+    uint64_t reader_retries;                        // Renders that re-read parameters changed under them
+    uint64_t late_by_period;                        // wg_output() writes more than one sample period past their deadline
+    uint64_t late_max_ns;
+};
+
+struct wg_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t table_size;
+    uint32_t num_tables;
+    uint32_t table_offset[WG_FILE_MAX_TABLES];      // Byte offset of each float table from start of file
+};
+
+// Called by wg_output() at each sample's deadline with the DAC code to write
+typedef void (*wg_write_fn)(void* user, unsigned int code);
+
+struct wg_tables;
+struct wg_engine;
+
+// Read-only tables any number of engines share
+size_t wg_tables_size(void);
+struct wg_tables* wg_tables_init(void* memory, size_t size);
+const float* wg_table(const struct wg_tables* tables, int t);
+int wg_bandlimited_level(double frequency, double sample_rate);
+
+// Wavetable files, setup only: writing uses stdio, mapped tables point into the file and need
+// wg_tables_map_size() bytes. NULL when the file is not in the current format
+int wg_tables_write(const struct wg_tables* tables, const char* path);
+size_t wg_tables_map_size(void);
+struct wg_tables* wg_tables_map(void* memory, size_t size, const void* file, size_t file_size);
+
+// One generator, NULL when memory is too small or misaligned, sample_rate is below WG_SAMPLE_RATE_MIN
+// or the parameters are out of range
+size_t wg_engine_size(void);
+struct wg_engine* wg_engine_init(void* memory, size_t size, const struct wg_tables* tables,
+                                 unsigned int sample_rate, const struct wg_params* params);
+
+// Any thread, lock-free. Returns the parameter version the change will be rendered with, or a WG_ERR_ code
+int64_t wg_set_params(struct wg_engine* engine, const struct wg_params* params);
+void wg_get_params(struct wg_engine* engine, struct wg_params* params);
+
+// Render thread only. Each call picks up the latest parameters once and renders n samples with them
+void wg_render(struct wg_engine* engine, unsigned int* codes, int n);
+void wg_render_float(struct wg_engine* engine, float* out, int n);
+uint64_t wg_rendered_version(const struct wg_engine* engine);
+
+// Renders blocks and writes each sample at an absolute CLOCK_MONOTONIC deadline until *running is false
+void wg_output(struct wg_engine* engine, wg_write_fn write, void* user, const volatile bool* running);
+
+// Counters are updated without atomics by their owning thread, a snapshot may be a block behind
+void wg_get_stats(const struct wg_engine* engine, struct wg_stats* stats);
+
+// Parsing shared by the front ends, no output on error
+int wg_parse_number(const char* text, void* value, int format, float min, float max);
+void wg_constrain(void* value, int format, float min, float max);
+int wg_waveform_from_name(const char* name);
+const char* wg_waveform_name(int waveform);
+
+#endif